@@ -48,6 +48,8 @@
 
 #include <errno.h>
 #include <stddef.h>
+#include <stdint.h>
+#include <sys/uio.h>
 
 #ifdef __cplusplus
 extern "C" {
@@ -85,7 +87,24 @@ enum bundle_type {
 	BUNDLE_TYPE_STR = 1 | BUNDLE_TYPE_MEASURABLE,	/* Default */
 	BUNDLE_TYPE_STR_ARRAY = BUNDLE_TYPE_STR | BUNDLE_TYPE_ARRAY | BUNDLE_TYPE_MEASURABLE,
 	BUNDLE_TYPE_BYTE = 2,
-	BUNDLE_TYPE_BYTE_ARRAY = BUNDLE_TYPE_BYTE | BUNDLE_TYPE_ARRAY
+	BUNDLE_TYPE_BYTE_ARRAY = BUNDLE_TYPE_BYTE | BUNDLE_TYPE_ARRAY,
+	BUNDLE_TYPE_INT64 = 3 | BUNDLE_TYPE_PRIMITIVE | BUNDLE_TYPE_MEASURABLE,	/* int64_t */
+	BUNDLE_TYPE_INT64_ARRAY = BUNDLE_TYPE_INT64 | BUNDLE_TYPE_ARRAY,
+	BUNDLE_TYPE_DOUBLE = 4 | BUNDLE_TYPE_PRIMITIVE | BUNDLE_TYPE_MEASURABLE,	/* double */
+	BUNDLE_TYPE_DOUBLE_ARRAY = BUNDLE_TYPE_DOUBLE | BUNDLE_TYPE_ARRAY,
+	BUNDLE_TYPE_BOOL = 5 | BUNDLE_TYPE_PRIMITIVE | BUNDLE_TYPE_MEASURABLE,	/* int, 0 or 1 */
+	BUNDLE_TYPE_BOOL_ARRAY = BUNDLE_TYPE_BOOL | BUNDLE_TYPE_ARRAY,
+	BUNDLE_TYPE_BUNDLE = 6	/* Nested bundle */
+};
+
+/**
+ * Policies for a key existing in both bundles, on bundle_merge()
+ * @see bundle_merge()
+ */
+enum bundle_merge_policy {
+	BUNDLE_MERGE_OVERWRITE = 0,	/* Value from source replaces value in destination */
+	BUNDLE_MERGE_KEEP,	/* Value in destination is kept */
+	BUNDLE_MERGE_FAIL	/* Nothing is merged, and merge fails */
 };
 
 /**
@@ -94,6 +113,12 @@ enum bundle_type {
  */
 typedef struct keyval_t bundle_keyval_t;
 
+/**
+ * A key handle, which keeps a key with its precomputed hash and length.
+ * @see bundle_key_get()
+ */
+typedef struct keyval_key_t bundle_key_t;
+
 
 /**
  * bundle_iterator is a new iterator function type for bundle_foreach()
@@ -107,6 +132,32 @@ typedef void (*bundle_iterator_t) (
 );
 
 
+/**
+ * bundle_filter_t is a function type to select keyvals
+ * @return	Non-zero to select the keyval, 0 to skip it
+ * @see bundle_project()
+ * @see bundle_encode_filtered()
+ */
+typedef int (*bundle_filter_t) (
+		const char *key,
+		const int type,
+		const bundle_keyval_t *kv,
+		void *user_data
+);
+
+
+/**
+ * A cursor to iterate a bundle without callback.
+ * Allocate it anywhere (e.g. on stack). Its members are private.
+ * @see bundle_iter_init()
+ * @see bundle_iter_next()
+ */
+typedef struct {
+	void *_b;
+	void *_next;
+} bundle_iter_t;
+
+
 /**
  * bundle_iterate_cb_t is an iterator function type for bundle_iterate()
  * @see bundle_iterate()
@@ -115,6 +166,42 @@ typedef void (*bundle_iterator_t) (
 typedef void (*bundle_iterate_cb_t) (const char *key, const char *val, void *data);
 
 
+/**
+ * Flags for bundle_encode_with_flags()
+ * @see bundle_encode_with_flags()
+ */
+enum bundle_encode_flag {
+	BUNDLE_ENCODE_CANONICAL = 0x01	/* Keyvals are encoded in key order, so that equal bundles are encoded to the same bytes */
+};
+
+/**
+ * Flags for bundle_send()
+ * @see bundle_send()
+ */
+enum bundle_send_flag {
+	BUNDLE_SEND_PASS_FD = 0x01	/* Values of BUNDLE_SEND_FD_THRESHOLD bytes or more are passed by memfds, not copied through the socket */
+};
+
+/* Min size of a str or byte value to be passed by a memfd */
+#define BUNDLE_SEND_FD_THRESHOLD (64 * 1024)
+
+/**
+ * Flags for bundle_raw_append()
+ * @see bundle_raw_append()
+ */
+enum bundle_raw_append_flag {
+	BUNDLE_RAW_APPEND_CHECK_DUP = 0x01	/* Fail if the key already exists in the data */
+};
+
+/**
+ * bundle_free_func_t is a function type to free memory, whose ownership is taken by bundle
+ * @see bundle_add_byte_nocopy()
+ * @see bundle_add_str_take()
+ * @see bundle_add_str_array_take()
+ */
+typedef void (*bundle_free_func_t) (void *ptr);
+
+
 /** 
  * @brief 	Create a bundle object.
  * @pre			None
@@ -133,6 +220,53 @@ typedef void (*bundle_iterate_cb_t) (const char *key, const char *val, void *dat
  */
 API bundle*		bundle_create(void);
 
+/**
+ * @brief	Create a bundle object, with storage for given number of key/values
+ * @pre			None
+ * @post		None
+ * @see			bundle_create()
+ * @see			bundle_clear()
+ * @param[in]	capacity	Expected number of key/values
+ * @return	bundle object
+ * @retval	NULL	on failure creating an object
+ * @remark	Key index and keyval nodes are allocated in advance.
+ 			Up to capacity of deleted keyval nodes are kept for reuse. A bundle from bundle_create() keeps none. \n
+ 			When NULL is returned, errno is set to one of the following values; \n
+ 			EINVAL : capacity is negative \n
+ 			ENOMEM : No memory to create an object
+ @code
+ #include <bundle.h>
+ bundle *b = bundle_create_with_capacity(50);
+ bundle_free(b);
+ @endcode
+ */
+API bundle*		bundle_create_with_capacity(int capacity);
+
+/**
+ * @brief		Remove all key/values from given bundle object, keeping its storage
+ * @pre			b must be a valid bundle object.
+ * @post		b is empty.
+ * @see			bundle_create_with_capacity()
+ * @param[in]	b	bundle object to be cleared
+ * @return		Operation result;
+ * @retval		0 success
+ * @retval		-1 failure
+ * @remark		Key index, keyval nodes and value buffers are kept, and reused by following adds.
+ 				Use this to reuse one bundle object for many requests.
+ 				Large value buffers are freed, and kept nodes are limited to the capacity given to bundle_create_with_capacity().
+ @code
+ #include <bundle.h>
+ bundle *b = bundle_create_with_capacity(50);
+ while(get_request(req)) {
+   bundle_add(b, "foo_key", req->foo);
+   // ...
+   bundle_clear(b);
+ }
+ bundle_free(b);
+ @endcode
+ */
+API int			bundle_clear(bundle *b);
+
 /**
  * @brief		Free given bundle object with key/values in it
  * @pre			b must be a valid bundle object.
@@ -203,6 +337,115 @@ API int bundle_add_str_array(bundle *b, const char *key, const char **str_array,
  */
 API int				bundle_add(bundle *b, const char *key, const char *val);
 
+/**
+ * @brief		Set a string type value for a key. If the key does not exist, it is added.
+ * @pre			b must be a valid bundle object.
+ * @post		None
+ * @see			bundle_add()
+ * @see			bundle_get_val()
+ * @param[in]	b	bundle object
+ * @param[in]	key	key
+ * @param[in]	str	value
+ * @return		Operation result
+ * @retval		0	success
+ * @retval		-1	failure
+ *
+ * @remark		Existing keyval is reused, and so is its value buffer if the new value fits in it.
+  				If the existing value has another type, it is replaced. \n
+  				When -1 is returned, errno is set to one of the following values; \n
+  				EKEYREJECTED : key is rejected (NULL or sth) \n
+  				EINVAL : b or str is not valid (NULL or sth) \n
+  				ENOMEM : No memory for the value \n
+ @code
+ #include <bundle.h>
+ bundle *b = bundle_create();
+ bundle_set_str(b, "foo_key", "bar_val");	// add
+ bundle_set_str(b, "foo_key", "baz");	// update, without new allocation
+
+ bundle_free(b);
+ @endcode
+ */
+API int				bundle_set_str(bundle *b, const char *key, const char *str);
+
+/**
+ * @brief		Add a string type key-value pair into bundle, taking the ownership of key and str without copying them.
+ * @pre			b must be a valid bundle object.
+ * @post		On success, key and str belong to b. DO NOT free or modify them.
+ * @see			bundle_add()
+ * @see			bundle_add_str_array_take()
+ * @param[in]	b	bundle object
+ * @param[in]	key	key, allocated by the caller
+ * @param[in]	str	value, allocated by the caller
+ * @param[in]	free_fn	function to free key and str when b does not need them any more. If NULL, they are not freed, and they must outlive b.
+ * @return		Operation result
+ * @retval		0	success
+ * @retval		-1	failure
+ *
+ * @remark		On failure, key and str still belong to the caller.
+  				Keys are shared by all bundles, so key is freed as soon as it is added. \n
+  				When -1 is returned, errno is set to one of the following values; \n
+  				EKEYREJECTED : key is rejected (NULL or sth) \n
+ 				EPERM : key is already exist, not permitted to overwrite value \n
+  				EINVAL : b or str is not valid (NULL or sth) \n
+ @code
+ #include <bundle.h>
+ bundle *b = bundle_create();
+ bundle_add_str_take(b, strdup("foo_key"), strdup("bar_val"), free);	// no copy
+
+ bundle_free(b);	// key and value are freed with free()
+ @endcode
+ */
+API int				bundle_add_str_take(bundle *b, char *key, char *str, bundle_free_func_t free_fn);
+
+/**
+ * @brief		Set a string array type value for a key. If the key does not exist, it is added.
+ * @pre			b must be a valid bundle object.
+ * @post		None
+ * @see			bundle_add_str_array()
+ * @see			bundle_get_str_array()
+ * @param[in]	b	bundle object
+ * @param[in]	key	key
+ * @param[in]	str_array	string array. If NULL, array items are empty.
+ * @param[in]	len	Length of array
+ * @return		Operation result
+ * @retval		0	success
+ * @retval		-1	failure
+ *
+ * @remark		Existing keyval is reused, and so are its array and item buffers if new values fit in them.
+  				If the existing value has another type, it is replaced. \n
+  				When -1 is returned, errno is set to one of the following values; \n
+  				EKEYREJECTED : key is rejected (NULL or sth) \n
+  				EINVAL : b or len is not valid \n
+  				ENOMEM : No memory for the value \n
+ */
+API int				bundle_set_str_array(bundle *b, const char *key, const char **str_array, const int len);
+
+/**
+ * @brief		Add a string array type key-value pair into bundle, taking the ownership of key, str_array and its items without copying them.
+ * @pre			b must be a valid bundle object.
+ * @post		On success, key, str_array and its items belong to b. DO NOT free or modify them.
+ * @see			bundle_add_str_array()
+ * @see			bundle_add_str_take()
+ * @param[in]	b	bundle object
+ * @param[in]	key	key, allocated by the caller
+ * @param[in]	str_array	string array, allocated by the caller. Each item is also allocated by the caller, or NULL.
+ * @param[in]	len	Length of array
+ * @param[in]	free_fn	function to free key, str_array and its items when b does not need them any more. If NULL, they are not freed, and they must outlive b.
+ * @return		Operation result
+ * @retval		0	success
+ * @retval		-1	failure
+ *
+ * @remark		On failure, key and str_array still belong to the caller.
+  				Keys are shared by all bundles, so key is freed as soon as it is added.
+  				If an item is changed later, b copies the array into its own buffers and frees the taken ones. \n
+  				When -1 is returned, errno is set to one of the following values; \n
+  				EKEYREJECTED : key is rejected (NULL or sth) \n
+ 				EPERM : key is already exist, not permitted to overwrite value \n
+  				EINVAL : b, str_array or len is not valid \n
+  				ENOMEM : No memory \n
+ */
+API int				bundle_add_str_array_take(bundle *b, char *key, char **str_array, const int len, bundle_free_func_t free_fn);
+
 /**
  * @brief		Delete val with given key
  * @pre			b must be a valid bundle object.
@@ -228,6 +471,104 @@ API int				bundle_add(bundle *b, const char *key, const char *val);
  @endcode
  */
 API int				bundle_del(bundle *b, const char* key);
+
+/**
+ * @brief		Get a handle of a key, for repeated lookups with the key
+ * @pre			None
+ * @post		Release the handle with bundle_key_put() when it is not needed any more.
+ * @see			bundle_key_put()
+ * @see			bundle_add_str_k()
+ * @see			bundle_get_str_k()
+ * @see			bundle_del_k()
+ * @param[in]	key	key
+ * @return		Key handle
+ * @retval		NULL	Failure
+ *
+ * @remark		The handle is shared by all bundles and threads. Its hash and length are computed only once here. \n
+  				When NULL is returned, errno is set to one of the following values; \n
+  				EKEYREJECTED : key is invalid (NULL or sth) \n
+  				ENOMEM : No memory \n
+ @code
+ #include <bundle.h>
+ static const bundle_key_t *key_operation;
+ char *op = NULL;
+
+ if(!key_operation) key_operation = bundle_key_get("__APP_SVC_OP_TYPE__");	// once
+
+ bundle_get_str_k(b, key_operation, &op);	// No hashing nor strcmp
+ @endcode
+ */
+API const bundle_key_t *	bundle_key_get(const char *key);
+
+/**
+ * @brief		Release a key handle
+ * @pre			key must be a handle from bundle_key_get().
+ * @post		key must not be used any more.
+ * @see			bundle_key_get()
+ * @param[in]	key	key handle
+ * @return		None
+ */
+API void				bundle_key_put(const bundle_key_t *key);
+
+/**
+ * @brief		Add a string type key-value pair into bundle, with a key handle
+ * @pre			b must be a valid bundle object. key must be a handle from bundle_key_get().
+ * @post		None
+ * @see			bundle_add_str()
+ * @see			bundle_key_get()
+ * @param[in]	b	bundle object
+ * @param[in]	key	key handle
+ * @param[in]	str	value
+ * @return		Operation result
+ * @retval		0	success
+ * @retval		-1	failure
+ *
+ * @remark		When -1 is returned, errno is set to one of the following values; \n
+  				EKEYREJECTED : key is rejected (NULL or sth) \n
+ 				EPERM : key is already exist, not permitted to overwrite value \n
+  				EINVAL : b or str is not valid (NULL or sth) \n
+ */
+API int				bundle_add_str_k(bundle *b, const bundle_key_t *key, const char *str);
+
+/**
+ * @brief		Get a string type value with a key handle
+ * @pre			b must be a valid bundle object. key must be a handle from bundle_key_get().
+ * @post		None
+ * @see			bundle_get_str()
+ * @see			bundle_key_get()
+ * @param[in]	b	bundle object
+ * @param[in]	key	key handle
+ * @param[out]	str	value. Do not free it.
+ * @return		Operation result
+ * @retval		0	success
+ * @retval		-1	failure
+ *
+ * @remark		When -1 is returned, errno is set to one of the following values; \n
+  				EINVAL : b is invalid (NULL or sth) \n
+  				ENOKEY : No key exist \n
+  				EKEYREJECTED : key is invalid (NULL or sth) \n
+  				ENOTSUP : value is not a string \n
+ */
+API int				bundle_get_str_k(bundle *b, const bundle_key_t *key, char **str);
+
+/**
+ * @brief		Delete val with a key handle
+ * @pre			b must be a valid bundle object. key must be a handle from bundle_key_get().
+ * @post		None
+ * @see			bundle_del()
+ * @see			bundle_key_get()
+ * @param[in]	b	bundle object
+ * @param[in]	key	key handle
+ * @return		Operation result
+ * @retval		0	Success
+ * @retval		-1	Failure
+ *
+ * @remark		When -1 is returned, errno is set to one of the following values; \n
+  				EINVAL : b is invalid (NULL or sth) \n
+  				ENOKEY : No key exist \n
+  				EKEYREJECTED : key is invalid (NULL or sth) \n
+ */
+API int				bundle_del_k(bundle *b, const bundle_key_t *key);
 /**
  * @brief		Get string array value from key
  * @pre			b must be a valid bundle object.
@@ -290,85 +631,433 @@ API const char** bundle_get_str_array(bundle *b, const char *key,int *len);
 API const char*		bundle_get_val(bundle *b, const char *key);
 
 /**
- * @brief	Get the number of bundle items
+ * @brief		Add string type key-value pairs into bundle at once
  * @pre			b must be a valid bundle object.
  * @post		None
- * @see			None
+ * @see			bundle_add()
+ * @see			bundle_get_many()
  * @param[in]	b	bundle object
- * @return		Number of bundle items
- * @remark		None
+ * @param[in]	keys	array of keys
+ * @param[in]	vals	array of values. vals[i] is the value for keys[i].
+ * @param[in]	n	length of keys and vals
+ * @return		Operation result
+ * @retval		0	success
+ * @retval		-1	failure
+ *
+ * @remark		Storage is sized once for all pairs. If any pair fails, none of them are added. \n
+  				When -1 is returned, errno is set to one of the following values; \n
+  				EKEYREJECTED : a key is rejected (NULL or sth) \n
+ 				EPERM : a key already exists in b or appears twice in keys \n
+  				EINVAL : b, keys, vals or n is not valid \n
  @code
  #include <bundle.h>
- bundle *b = bundle_create(); // Create new bundle object
- bundle_add(b, "key1", "val1"); // add a key-val pair
- int count = bundle_get_count(b);	// count=1
- bundle_add(b, "key2", "val2"); // add another key-val pair
- count = bundle_get_count(b); // count=2
+ const char *keys[] = { "k1", "k2", "k3" };
+ const char *vals[] = { "v1", "v2", "v3" };
+ bundle *b = bundle_create();
+ bundle_add_many(b, keys, vals, 3);
 
  bundle_free(b);
  @endcode
  */
-API int				bundle_get_count(bundle *b);
-
+API int				bundle_add_many(bundle *b, const char **keys, const char **vals, const int n);
 
 /**
- * @brief	Get a type of a value with certain key
- * @pre		b must be a valid bundle object
- * @post	None
- * @see		bundle_type_t
- * @param[in]	b	A bundle
- * @param[in]	key	A key in bundle
- * @return	Type of a key in b
- * @remark
+ * @brief		Get string values for many keys at once
+ * @pre			b must be a valid bundle object.
+ * @post		vals[i] is set to the value of keys[i], or NULL if it has no string value.
+ * @see			bundle_get_val()
+ * @see			bundle_add_many()
+ * @param[in]	b	bundle object
+ * @param[in]	keys	array of keys
+ * @param[out]	vals	array to be filled with values
+ * @param[in]	n	length of keys and vals
+ * @return		Number of keys found
+ * @retval		-1	failure
+ * @remark		DO NOT free or modify returned strings! \n
+  				When -1 is returned, errno is set to one of the following values; \n
+  				EINVAL : b, keys, vals or n is not valid \n
  @code
+ #include <bundle.h>
+ const char *keys[] = { "k1", "k2" };
+ const char *vals[2];
+ bundle_get_many(b, keys, vals, 2);	// vals = { "v1", "v2" }
  @endcode
  */
-API int bundle_get_type(bundle *b, const char *key);
-
+API int				bundle_get_many(bundle *b, const char **keys, const char **vals, const int n);
 
 /**
- * @brief	Duplicate given bundle object
+ * @brief	Get the number of bundle items
  * @pre			b must be a valid bundle object.
  * @post		None
  * @see			None
- * @param[in]	b_from	bundle object to be duplicated
- * @return		New bundle object
- * @retval		NULL	Failure
+ * @param[in]	b	bundle object
+ * @return		Number of bundle items
  * @remark		None
  @code
  #include <bundle.h>
  bundle *b = bundle_create(); // Create new bundle object
- bundle_add(b, "foo_key", "bar_val"); // add a key-val pair
- bundle *b_dup = bundle_dup(b);	// duplicate b 
+ bundle_add(b, "key1", "val1"); // add a key-val pair
+ int count = bundle_get_count(b);	// count=1
+ bundle_add(b, "key2", "val2"); // add another key-val pair
+ count = bundle_get_count(b); // count=2
 
  bundle_free(b);
- bundle_free(b_dup);
  @endcode
  */
-API bundle *		bundle_dup(bundle *b_from);
+API int				bundle_get_count(bundle *b);
+
 
 /**
- * @brief	iterate callback function with each key/val pairs in bundle. (NOTE: Only BUNDLE_TYPE_STR type values come!)
+ * @brief		Add an int64_t type key-value pair into bundle.
  * @pre			b must be a valid bundle object.
  * @post		None
- * @see			None
+ * @see			bundle_get_int64()
  * @param[in]	b	bundle object
- * @param[in]	callback	iteration callback function
- * @param[in]	data	data for callback function
- * @remark		This function is obsolete, and does not give values whose types are not BUNDLE_TYPE_STR.
+ * @param[in]	key	key
+ * @param[in]	val	value
+ * @return		Operation result
+ * @retval		0	success
+ * @retval		-1	failure
+ *
+ * @remark		Value is stored in the keyval itself, without a value buffer. \n
+  				When -1 is returned, errno is set to one of the following values; \n
+  				EKEYREJECTED : key is rejected (NULL or sth) \n
+ 				EPERM : key is already exist, not permitted to overwrite value \n
+  				EINVAL : b is not valid (NULL or sth) \n
  @code
- @include <stdio.h>
  #include <bundle.h>
- void sample_cb(const char *k, const char *v, void *data) {
-   printf("%s -> %s\n", k, v);
- }
+ bundle *b = bundle_create();
+ bundle_add_int64(b, "count", 42);
 
- int main(void) {
-	 bundle *b = bundle_create(); // Create new bundle object
-	 bundle_add(b, "k1", "v1"); // add a key-val pair
-	 bundle_add(b, "k2", "v2"); // add a key-val pair
-	 bundle_add(b, "k3", "v3"); // add a key-val pair
-	 bundle_iterate(b, sample_cb, NULL);	// iterate sample_cb for each key/val
+ int64_t count = 0;
+ bundle_get_int64(b, "count", &count);	// count = 42
+
+ bundle_free(b);
+ @endcode
+ */
+API int bundle_add_int64(bundle *b, const char *key, int64_t val);
+
+/**
+ * @brief		Get an int64_t type value from key
+ * @pre			b must be a valid bundle object.
+ * @post		None
+ * @see			bundle_add_int64()
+ * @param[in]	b	bundle object
+ * @param[in]	key	key
+ * @param[out]	val	returned value
+ * @return		Operation result
+ * @retval		0 on success
+ * @retval		-1 on failure
+ * @remark		When -1 is returned, errno is set to one of the following values; \n
+  				EINVAL : b is invalid \n
+  				ENOKEY : No key exists \n
+  				EKEYREJECTED : invalid key (NULL or sth) \n
+  				ENOTSUP : value of key is not BUNDLE_TYPE_INT64 \n
+ */
+API int bundle_get_int64(bundle *b, const char *key, int64_t *val);
+
+/**
+ * @brief		Add a double type key-value pair into bundle.
+ * @pre			b must be a valid bundle object.
+ * @post		None
+ * @see			bundle_get_double()
+ * @see			bundle_add_int64()
+ * @param[in]	b	bundle object
+ * @param[in]	key	key
+ * @param[in]	val	value
+ * @return		Operation result
+ * @retval		0	success
+ * @retval		-1	failure
+ * @remark		Same to bundle_add_int64(), except the type.
+ */
+API int bundle_add_double(bundle *b, const char *key, double val);
+
+/**
+ * @brief		Get a double type value from key
+ * @pre			b must be a valid bundle object.
+ * @post		None
+ * @see			bundle_add_double()
+ * @see			bundle_get_int64()
+ * @param[in]	b	bundle object
+ * @param[in]	key	key
+ * @param[out]	val	returned value
+ * @return		Operation result
+ * @retval		0 on success
+ * @retval		-1 on failure
+ * @remark		Same to bundle_get_int64(), except the type.
+ */
+API int bundle_get_double(bundle *b, const char *key, double *val);
+
+/**
+ * @brief		Add a boolean type key-value pair into bundle.
+ * @pre			b must be a valid bundle object.
+ * @post		None
+ * @see			bundle_get_bool()
+ * @see			bundle_add_int64()
+ * @param[in]	b	bundle object
+ * @param[in]	key	key
+ * @param[in]	val	value. Non-zero value is stored as 1.
+ * @return		Operation result
+ * @retval		0	success
+ * @retval		-1	failure
+ * @remark		Same to bundle_add_int64(), except the type.
+ */
+API int bundle_add_bool(bundle *b, const char *key, int val);
+
+/**
+ * @brief		Get a boolean type value from key
+ * @pre			b must be a valid bundle object.
+ * @post		None
+ * @see			bundle_add_bool()
+ * @see			bundle_get_int64()
+ * @param[in]	b	bundle object
+ * @param[in]	key	key
+ * @param[out]	val	returned value, 0 or 1
+ * @return		Operation result
+ * @retval		0 on success
+ * @retval		-1 on failure
+ * @remark		Same to bundle_get_int64(), except the type.
+ */
+API int bundle_get_bool(bundle *b, const char *key, int *val);
+
+/**
+ * @brief		Add an int64_t array type key-value pair into bundle.
+ * @pre			b must be a valid bundle object.
+ * @post		None
+ * @see			bundle_get_int64_array()
+ * @param[in]	b	bundle object
+ * @param[in]	key	key
+ * @param[in]	array	values. If NULL, array items are 0.
+ * @param[in]	len	Length of array
+ * @return		Operation result
+ * @retval		0	success
+ * @retval		-1	failure
+ * @remark		When -1 is returned, errno is set to one of the following values; \n
+  				EKEYREJECTED : key is rejected (NULL or sth) \n
+ 				EPERM : key is already exist, not permitted to overwrite value \n
+  				EINVAL : b is not valid (NULL or sth) \n
+ @code
+ #include <bundle.h>
+ int64_t ts[] = { 1000, 2000, 3000 };
+ bundle *b = bundle_create();
+ bundle_add_int64_array(b, "timestamps", ts, 3);
+
+ const int64_t *arr = NULL;
+ unsigned int len = 0;
+ bundle_get_int64_array(b, "timestamps", &arr, &len);	// arr[1] = 2000, len = 3
+
+ bundle_free(b);
+ @endcode
+ */
+API int bundle_add_int64_array(bundle *b, const char *key, const int64_t *array, const unsigned int len);
+
+/**
+ * @brief		Get an int64_t array type value from key
+ * @pre			b must be a valid bundle object.
+ * @post		None
+ * @see			bundle_add_int64_array()
+ * @param[in]	b	bundle object
+ * @param[in]	key	key
+ * @param[out]	array	items. NULL if len is 0.
+ * @param[out]	len	Length of array
+ * @return		Operation result
+ * @retval		0 on success
+ * @retval		-1 on failure
+ * @remark		Items are stored contiguously in the bundle. DO NOT free or modify returned array! \n
+  				When -1 is returned, errno is set to one of the following values; \n
+  				EINVAL : b is invalid \n
+  				ENOKEY : No key exists \n
+  				EKEYREJECTED : invalid key (NULL or sth) \n
+  				ENOTSUP : value of key is not BUNDLE_TYPE_INT64_ARRAY \n
+ */
+API int bundle_get_int64_array(bundle *b, const char *key, const int64_t **array, unsigned int *len);
+
+/**
+ * @brief		Add a double array type key-value pair into bundle.
+ * @see			bundle_add_int64_array()
+ * @remark		Same to bundle_add_int64_array(), except the type.
+ */
+API int bundle_add_double_array(bundle *b, const char *key, const double *array, const unsigned int len);
+
+/**
+ * @brief		Get a double array type value from key
+ * @see			bundle_get_int64_array()
+ * @remark		Same to bundle_get_int64_array(), except the type.
+ */
+API int bundle_get_double_array(bundle *b, const char *key, const double **array, unsigned int *len);
+
+/**
+ * @brief		Add a boolean array type key-value pair into bundle.
+ * @see			bundle_add_int64_array()
+ * @remark		Same to bundle_add_int64_array(), except the type. Non-zero items are stored as 1.
+ */
+API int bundle_add_bool_array(bundle *b, const char *key, const int *array, const unsigned int len);
+
+/**
+ * @brief		Get a boolean array type value from key
+ * @see			bundle_get_int64_array()
+ * @remark		Same to bundle_get_int64_array(), except the type.
+ */
+API int bundle_get_bool_array(bundle *b, const char *key, const int **array, unsigned int *len);
+
+/**
+ * @brief		Add a bundle type key-value pair into bundle.
+ * @pre			b and child must be valid bundle objects.
+ * @post		None
+ * @see			bundle_get_bundle()
+ * @param[in]	b	bundle object
+ * @param[in]	key	key
+ * @param[in]	child	bundle to be nested. Its key-values are copied.
+ * @return		Operation result
+ * @retval		0	success
+ * @retval		-1	failure
+ * @remark		child is encoded into b as it is, without base64 and checksum of its own.
+  				Changing child after this does not change b. \n
+  				When -1 is returned, errno is set to one of the following values; \n
+  				EKEYREJECTED : key is rejected (NULL or sth) \n
+ 				EPERM : key is already exist, not permitted to overwrite value \n
+  				EINVAL : b or child is not valid (NULL or sth) \n
+ @code
+ #include <bundle.h>
+ bundle *child = bundle_create();
+ bundle_add(child, "foo", "bar");
+
+ bundle *b = bundle_create();
+ bundle_add_bundle(b, "child", child);
+ bundle_free(child);
+
+ bundle *c = NULL;
+ bundle_get_bundle(b, "child", &c);	// bundle_get_val(c, "foo") = "bar"
+
+ bundle_free(b);	// c is freed together.
+ @endcode
+ */
+API int bundle_add_bundle(bundle *b, const char *key, bundle *child);
+
+/**
+ * @brief		Get a bundle type value from key
+ * @pre			b must be a valid bundle object.
+ * @post		None
+ * @see			bundle_add_bundle()
+ * @param[in]	b	bundle object
+ * @param[in]	key	key
+ * @param[out]	child	returned bundle
+ * @return		Operation result
+ * @retval		0 on success
+ * @retval		-1 on failure
+ * @remark		child is decoded on the first call, and kept in b. DO NOT free child!
+  				It is freed when b is freed, or the key is deleted. \n
+  				child is read-only, and modifying it fails with EROFS. To change it, bundle_dup() child, and replace the key with bundle_del() and bundle_add_bundle(). \n
+  				When -1 is returned, errno is set to one of the following values; \n
+  				EINVAL : b or child is invalid \n
+  				ENOKEY : No key exists \n
+  				EKEYREJECTED : invalid key (NULL or sth) \n
+  				ENOTSUP : value of key is not BUNDLE_TYPE_BUNDLE \n
+  				EBADMSG : encoded child is broken \n
+ */
+API int bundle_get_bundle(bundle *b, const char *key, bundle **child);
+
+/**
+ * @brief	Get a type of a value with certain key
+ * @pre		b must be a valid bundle object
+ * @post	None
+ * @see		bundle_type_t
+ * @param[in]	b	A bundle
+ * @param[in]	key	A key in bundle
+ * @return	Type of a key in b
+ * @remark
+ @code
+ @endcode
+ */
+API int bundle_get_type(bundle *b, const char *key);
+
+
+/**
+ * @brief	Duplicate given bundle object
+ * @pre			b must be a valid bundle object.
+ * @post		None
+ * @see			None
+ * @param[in]	b_from	bundle object to be duplicated
+ * @return		New bundle object
+ * @retval		NULL	Failure
+ * @remark		None
+ @code
+ #include <bundle.h>
+ bundle *b = bundle_create(); // Create new bundle object
+ bundle_add(b, "foo_key", "bar_val"); // add a key-val pair
+ bundle *b_dup = bundle_dup(b);	// duplicate b 
+
+ bundle_free(b);
+ bundle_free(b_dup);
+ @endcode
+ */
+API bundle *		bundle_dup(bundle *b_from);
+
+/**
+ * @brief		Duplicate keyvals selected by a filter into a new bundle
+ * @pre			b_from must be a valid bundle object.
+ * @post		Returned bundle must be freed by bundle_free().
+ * @see			bundle_dup()
+ * @see			bundle_project_keys()
+ * @see			bundle_encode_filtered()
+ * @param[in]	b_from	bundle object
+ * @param[in]	filter	function to select keyvals. If NULL, all keyvals are selected.
+ * @param[in]	user_data	data for filter
+ * @return		New bundle with selected keyvals, in the same order as b_from
+ * @retval		NULL	Failure
+ * @remark		Unselected keyvals are never copied. \n
+  				When NULL is returned, errno is set to one of the following values; \n
+  				EINVAL : b_from is invalid (NULL) \n
+  				ENOMEM : No memory \n
+ @code
+ #include <bundle.h>
+ int not_internal(const char *key, const int type, const bundle_keyval_t *kv, void *user_data) {
+	 return strncmp(key, "__", 2);
+ }
+ bundle *b_pub = bundle_project(b, not_internal, NULL);	// Without internal keys
+ bundle_free(b_pub);
+ @endcode
+ */
+API bundle *		bundle_project(bundle *b_from, bundle_filter_t filter, void *user_data);
+
+/**
+ * @brief		Duplicate keyvals of given keys into a new bundle
+ * @pre			b_from must be a valid bundle object.
+ * @post		Returned bundle must be freed by bundle_free().
+ * @see			bundle_project()
+ * @param[in]	b_from	bundle object
+ * @param[in]	keys	keys to be copied. Keys which do not exist in b_from are skipped.
+ * @param[in]	n_keys	number of keys
+ * @return		New bundle with selected keyvals, in the order of keys
+ * @retval		NULL	Failure
+ * @remark		When NULL is returned, errno is set to one of the following values; \n
+  				EINVAL : b_from, keys or n_keys is invalid \n
+  				ENOMEM : No memory \n
+ */
+API bundle *		bundle_project_keys(bundle *b_from, const char **keys, const int n_keys);
+
+/**
+ * @brief	iterate callback function with each key/val pairs in bundle. (NOTE: Only BUNDLE_TYPE_STR type values come!)
+ * @pre			b must be a valid bundle object.
+ * @post		None
+ * @see			None
+ * @param[in]	b	bundle object
+ * @param[in]	callback	iteration callback function
+ * @param[in]	data	data for callback function
+ * @remark		This function is obsolete, and does not give values whose types are not BUNDLE_TYPE_STR.
+ @code
+ @include <stdio.h>
+ #include <bundle.h>
+ void sample_cb(const char *k, const char *v, void *data) {
+   printf("%s -> %s\n", k, v);
+ }
+
+ int main(void) {
+	 bundle *b = bundle_create(); // Create new bundle object
+	 bundle_add(b, "k1", "v1"); // add a key-val pair
+	 bundle_add(b, "k2", "v2"); // add a key-val pair
+	 bundle_add(b, "k3", "v3"); // add a key-val pair
+	 bundle_iterate(b, sample_cb, NULL);	// iterate sample_cb for each key/val
 	 return 0;
  } 
  @endcode
@@ -419,6 +1108,116 @@ API void			bundle_iterate(bundle *b, bundle_iterate_cb_t callback, void *cb_data
  */
 API void			bundle_foreach(bundle *b, bundle_iterator_t iter, void *user_data);
 
+/**
+ * @brief		Run an iterator function for each keyval whose key starts with prefix
+ * @pre			b must be a valid bundle object.
+ * @post		None
+ * @see			bundle_foreach()
+ * @see			bundle_count_prefix()
+ * @see			bundle_del_prefix()
+ * @param[in]	b	bundle object
+ * @param[in]	prefix	key prefix. "" matches all keys.
+ * @param[in]	iter	iteration callback function
+ * @param[in]	user_data	data for callback function
+ * @return		Number of visited keyvals
+ * @retval		-1	failure
+ * @remark		Keyvals are visited in key order. Only matching keys are visited, through a sorted key index,
+  				which is rebuilt on the first query after keys are added or deleted.
+  				Do not add or delete keys of b in iter. \n
+  				When -1 is returned, errno is set to one of the following values; \n
+  				EINVAL : b, prefix or iter is invalid (NULL) \n
+  				ENOMEM : No memory for the key index \n
+ @code
+ #include <bundle.h>
+ void strip_cb(const char *key, const int type, const bundle_keyval_t *kv, void *user_data) {
+	 // key starts with "__AUL_"
+ }
+ bundle_foreach_prefix(b, "__AUL_", strip_cb, NULL);
+ @endcode
+ */
+API int				bundle_foreach_prefix(bundle *b, const char *prefix, bundle_iterator_t iter, void *user_data);
+
+/**
+ * @brief		Count keyvals whose key starts with prefix
+ * @pre			b must be a valid bundle object.
+ * @post		None
+ * @see			bundle_foreach_prefix()
+ * @param[in]	b	bundle object
+ * @param[in]	prefix	key prefix. "" matches all keys.
+ * @return		Number of matching keyvals
+ * @retval		-1	failure
+ * @remark		When -1 is returned, errno is set to one of the following values; \n
+  				EINVAL : b or prefix is invalid (NULL) \n
+  				ENOMEM : No memory for the key index \n
+ */
+API int				bundle_count_prefix(bundle *b, const char *prefix);
+
+/**
+ * @brief		Delete keyvals whose key starts with prefix
+ * @pre			b must be a valid bundle object.
+ * @post		None
+ * @see			bundle_foreach_prefix()
+ * @see			bundle_del()
+ * @param[in]	b	bundle object
+ * @param[in]	prefix	key prefix. "" matches all keys.
+ * @return		Number of deleted keyvals
+ * @retval		-1	failure
+ * @remark		When -1 is returned, errno is set to one of the following values; \n
+  				EINVAL : b or prefix is invalid (NULL) \n
+  				ENOMEM : No memory for the key index \n
+ @code
+ #include <bundle.h>
+ bundle_del_prefix(b, "__AUL_");	// Strip internal keys
+ @endcode
+ */
+API int				bundle_del_prefix(bundle *b, const char *prefix);
+
+/**
+ * @brief		Initialize a cursor to iterate a bundle
+ * @pre			b must be a valid bundle object.
+ * @post		iter points the first keyval of b.
+ * @see			bundle_iter_next()
+ * @see			bundle_foreach()
+ * @param[in]	b	bundle object
+ * @param[out]	iter	cursor to be initialized
+ * @return		Operation result
+ * @retval		0	success
+ * @retval		-1	failure
+ * @remark		Keyvals are visited in the same order as bundle_foreach(), and the order is stable while b is not modified. \n
+  				When -1 is returned, errno is set to one of the following values; \n
+  				EINVAL : b or iter is invalid (NULL) \n
+ @code
+ #include <bundle.h>
+ bundle_iter_t it;
+ const char *key;
+ int type;
+ bundle_keyval_t *kv;
+
+ bundle_iter_init(b, &it);
+ while(bundle_iter_next(&it, &key, &type, &kv)) {
+	 if(0 == strncmp(key, "__AUL_", 6)) break;	// Stop early
+ }
+ @endcode
+ */
+API int				bundle_iter_init(bundle *b, bundle_iter_t *iter);
+
+/**
+ * @brief		Get the current keyval of a cursor, and move the cursor to the next one
+ * @pre			iter must be initialized by bundle_iter_init().
+ * @post		None
+ * @see			bundle_iter_init()
+ * @param[in]	iter	cursor
+ * @param[out]	key	key of the keyval. Can be NULL.
+ * @param[out]	type	type of the keyval. Can be NULL.
+ * @param[out]	kv	keyval object, to be used with bundle_keyval_*() functions. Can be NULL.
+ * @return		Whether a keyval is returned
+ * @retval		1	a keyval is returned
+ * @retval		0	no more keyval
+ * @remark		The keyval just returned can be deleted from the bundle while iterating.
+  				Any other modification of the bundle invalidates iter.
+ */
+API int				bundle_iter_next(bundle_iter_t *iter, const char **key, int *type, bundle_keyval_t **kv);
+
 
 /**
  * @brief	Get type for a bundle_keyval_t object.
@@ -440,12 +1239,26 @@ API int bundle_keyval_get_type(bundle_keyval_t *kv);
  * @see		bundle_foreach
  * @param[in]	kv	A bundle_keyval_t object
  * @return		Operation result
- * @retval		1	kv is an array.
+ * @retval		1	kv is an array, whose value is got by bundle_keyval_get_array_val().
  * @retval		0	kv is not an array.
- * @remark
+ * @remark		A primitive array (BUNDLE_TYPE_INT64_ARRAY, ...) is not an array here, because its items are stored in one block.
+ 				Get it by bundle_keyval_get_basic_val(). Use bundle_keyval_type_is_primitive_array() to tell it.
  */
 API int bundle_keyval_type_is_array(bundle_keyval_t *kv);
 
+/**
+ * @brief	Determine if kv is a primitive array type (BUNDLE_TYPE_INT64_ARRAY, ...) or not.
+ * @pre		kv must be a valid bundle_keyval_t object.
+ * @post	None
+ * @see		bundle_keyval_type_is_array
+ * @param[in]	kv	A bundle_keyval_t object
+ * @return		Operation result
+ * @retval		1	kv is a primitive array.
+ * @retval		0	kv is not a primitive array.
+ * @remark		Items are stored in one block, which is got by bundle_keyval_get_basic_val(). Its size is length of the array times size of an item.
+ */
+API int bundle_keyval_type_is_primitive_array(bundle_keyval_t *kv);
+
 
 /**
  * @brief	Get value and size of the value from kv of basic type.
@@ -504,7 +1317,312 @@ API int bundle_keyval_get_array_val(bundle_keyval_t *kv, void ***array_val, unsi
  bundle_free(b);
  @endcode
  */
-API int				bundle_encode(bundle *b, bundle_raw **r, int *len);
+API int				bundle_encode(bundle *b, bundle_raw **r, int *len);
+
+/**
+ * @brief	Encode bundle to bundle_raw format, with flags
+ * @pre			b must be a valid bundle object.
+ * @post		None
+ * @see			bundle_encode()
+ * @param[in]	b	bundle object
+ * @param[in]	flags	bitwise OR of bundle_encode_flag values
+ * @param[out]	r	returned bundle_raw data(byte data)
+ *					r MUST BE FREED by free(r).
+ * @param[out]	len	size of r (in bytes)
+ * @return	Operation result
+ * @retval		0		Success
+ * @retval		-1		Failure
+ * @remark		With BUNDLE_ENCODE_CANONICAL, two bundles with the same keys and values are encoded to the same bytes,
+  				regardless of their insertion order. So their encoded data or checksums can be compared directly.
+  				Key order comes from the sorted key index, which is built once until keys are changed. \n
+  				When -1 is returned, errno is set to one of the following values; \n
+  				EINVAL : b or flags is invalid \n
+  				ENOMEM : No memory \n
+ @code
+ #include <bundle.h>
+ bundle_raw *r1, *r2;
+ int len1, len2;
+ bundle_encode_with_flags(b1, BUNDLE_ENCODE_CANONICAL, &r1, &len1);
+ bundle_encode_with_flags(b2, BUNDLE_ENCODE_CANONICAL, &r2, &len2);
+ if(len1 == len2 && 0 == memcmp(r1, r2, len1)) {
+	 // b1 and b2 are equal
+ }
+ @endcode
+ */
+API int				bundle_encode_with_flags(bundle *b, int flags, bundle_raw **r, int *len);
+
+/**
+ * @brief	Encode bundle to binary format, as iovecs pointing keys and values in the bundle
+ * @pre			b must be a valid bundle object.
+ * @post		iov is valid until b is modified or freed. iov MUST BE FREED by free(iov).
+ * @see			bundle_decode_binary()
+ * @see			bundle_encode_binary()
+ * @param[in]	b	bundle object
+ * @param[out]	iov	array of iovecs. Segments in order make binary format data.
+ * @param[out]	iovcnt	number of iovecs
+ * @return	Operation result
+ * @retval		0		Success
+ * @retval		-1		Failure
+ * @remark		Binary format is bundle_raw without base64: checksum, and encoded keyvals.
+  				Only small headers are written into iov memory. Keys and values are not copied, and so iov can be passed to writev() or sendmsg().
+  				iovcnt can be larger than IOV_MAX for a big bundle. Then send iov in several calls. \n
+  				When -1 is returned, errno is set to one of the following values; \n
+  				EINVAL : b, iov or iovcnt is invalid (NULL) \n
+  				ENOMEM : No memory \n
+ @code
+ #include <bundle.h>
+ struct iovec *iov;
+ int iovcnt;
+ bundle_encode_iov(b, &iov, &iovcnt);
+ writev(fd, iov, iovcnt);
+ free(iov);
+ @endcode
+ */
+API int				bundle_encode_iov(bundle *b, struct iovec **iov, int *iovcnt);
+
+/**
+ * @brief	Encode bundle to binary format, in one allocated buffer
+ * @pre			b must be a valid bundle object.
+ * @post		*data MUST BE FREED by free(*data).
+ * @see			bundle_encode_iov()
+ * @see			bundle_decode_binary()
+ * @param[in]	b	bundle object
+ * @param[out]	data	binary format data
+ * @param[out]	len	size of data
+ * @return	Operation result
+ * @retval		0		Success
+ * @retval		-1		Failure
+ * @remark		data is same to segments of bundle_encode_iov() concatenated in order, and can be passed to bundle_raw_get_str() or bundle_raw_append(). \n
+  				When -1 is returned, errno is set to one of the following values; \n
+  				EINVAL : b, data or len is invalid (NULL) \n
+  				ENOMEM : No memory \n
+ @code
+ #include <bundle.h>
+ unsigned char *data;
+ size_t len;
+ bundle_encode_binary(b, &data, &len);
+ bundle_raw_append(&data, &len, "__CALLER_PID__", "1234", 0);
+ free(data);
+ @endcode
+ */
+API int				bundle_encode_binary(bundle *b, unsigned char **data, size_t *len);
+
+/**
+ * @brief	Decode binary format data to a bundle
+ * @pre			data must be binary format data, from bundle_encode_binary() or bundle_encode_iov().
+ * @post		Returned bundle must be freed by bundle_free().
+ * @see			bundle_encode_binary()
+ * @see			bundle_encode_iov()
+ * @param[in]	data	binary format data
+ * @param[in]	len	size of data
+ * @return	bundle object
+ * @retval	NULL	Failure
+ * @remark		When NULL is returned, errno is set to one of the following values; \n
+  				EINVAL : data or len is invalid \n
+  				EBADMSG : checksum of data is not valid, or data is broken \n
+  				ENOMEM : No memory \n
+ */
+API bundle *		bundle_decode_binary(const unsigned char *data, const size_t len);
+
+/**
+ * @brief	Get a string value from binary format data, without decoding it
+ * @pre			data must be binary format data, from bundle_encode_binary() or bundle_encode_iov().
+ * @post		*str points into data. It is valid while data is valid.
+ * @see			bundle_encode_binary()
+ * @see			bundle_get_val()
+ * @param[in]	data	binary format data
+ * @param[in]	len	size of data
+ * @param[in]	key	key
+ * @param[out]	str	string value in data
+ * @param[out]	size	length of the string, without the terminating null. Can be NULL.
+ * @return	Operation result
+ * @retval		0		Success
+ * @retval		-1		Failure
+ * @remark		Key is found by walking encoded keyvals with their sizes. No bundle or keyval is created.
+  				Checksum of data is not verified, so data must come from a trusted source. Sizes in data are checked against len. \n
+  				When -1 is returned, errno is set to one of the following values; \n
+  				EINVAL : data, len, key or str is invalid \n
+  				ENOKEY : No key exists \n
+  				ENOTSUP : value is not a string \n
+  				EBADMSG : data is broken \n
+ @code
+ #include <bundle.h>
+ const char *op;
+ if(0 == bundle_raw_get_str(data, len, "__OPERATION__", &op, NULL)) printf("%s\n", op);
+ @endcode
+ */
+API int				bundle_raw_get_str(const unsigned char *data, const size_t len, const char *key, const char **str, size_t *size);
+
+/**
+ * @brief	Append a string key/value to binary format data, without decoding it
+ * @pre			*data must be binary format data allocated by malloc(), from bundle_encode_binary().
+ * @post		*data may be moved by realloc(). *len is increased.
+ * @see			bundle_encode_binary()
+ * @see			bundle_add_str()
+ * @param[in,out]	data	binary format data
+ * @param[in,out]	len	size of data
+ * @param[in]	key	key
+ * @param[in]	str	string value
+ * @param[in]	flags	bitwise OR of enum bundle_raw_append_flag
+ * @return	Operation result
+ * @retval		0		Success
+ * @retval		-1		Failure
+ * @remark		Encoded key/value is appended at the end of data, and the checksum is updated. Existing key/values are not decoded or copied.
+  				Checksum is computed again over whole data, because MD5 cannot be continued from a previous checksum.
+  				Existing checksum is verified in the same pass, so broken data is not sealed with a new valid checksum. \n
+  				Without BUNDLE_RAW_APPEND_CHECK_DUP, caller must ensure that key does not exist in data. \n
+  				When -1 is returned, errno is set to one of the following values; \n
+  				EINVAL : data, len or str is invalid \n
+  				EKEYREJECTED : key is rejected (NULL or sth) \n
+  				EPERM : key is already exist (only with BUNDLE_RAW_APPEND_CHECK_DUP) \n
+  				EBADMSG : checksum of data is not valid, or data is broken \n
+  				ENOMEM : No memory \n
+ @code
+ #include <bundle.h>
+ bundle_raw_append(&data, &len, "__CALLER_PID__", "1234", BUNDLE_RAW_APPEND_CHECK_DUP);
+ @endcode
+ */
+API int				bundle_raw_append(unsigned char **data, size_t *len, const char *key, const char *str, int flags);
+
+/**
+ * @brief	Send a bundle to a socket, as a frame
+ * @pre			b must be a valid bundle object. fd must be a connected unix domain stream socket.
+ * @post		None
+ * @see			bundle_recv()
+ * @param[in]	fd	socket
+ * @param[in]	b	bundle object
+ * @param[in]	flags	bitwise OR of enum bundle_send_flag
+ * @return	Operation result
+ * @retval		0		Success
+ * @retval		-1		Failure
+ * @remark		Frame has a header, and binary format of the bundle. Keys and values are sent without copy, by bundle_encode_iov().
+  				With BUNDLE_SEND_PASS_FD, str and byte values of BUNDLE_SEND_FD_THRESHOLD bytes or more are copied into sealed memfds, and the fds are passed by SCM_RIGHTS. Up to 253 values are passed in a frame. \n
+  				This function blocks until whole frame is sent. SIGPIPE is not raised. \n
+  				When -1 is returned, errno is set to one of the following values; \n
+  				EINVAL : fd or b is invalid \n
+  				ENOMEM : No memory \n
+  				Or, errno set by memfd_create() or sendmsg(), like EPIPE.
+ @code
+ #include <bundle.h>
+ bundle_send(sock, b, BUNDLE_SEND_PASS_FD);
+ @endcode
+ */
+API int				bundle_send(int fd, bundle *b, int flags);
+
+/**
+ * @brief	Receive a bundle sent by bundle_send()
+ * @pre			fd must be a connected unix domain stream socket.
+ * @post		*b must be freed by bundle_free().
+ * @see			bundle_send()
+ * @param[in]	fd	socket
+ * @param[out]	b	received bundle object
+ * @return	Operation result
+ * @retval		0		Success
+ * @retval		-1		Failure
+ * @remark		Values passed by fds are mapped read-only into the bundle without copy, and the fds are closed. They are placed after the other keyvals.
+  				Passed memfds must be sealed against shrinking and writing, as bundle_send() does. Otherwise the frame is rejected with EBADMSG. \n
+  				This function blocks until whole frame is received. \n
+  				When -1 is returned, errno is set to one of the following values; \n
+  				EINVAL : fd or b is invalid \n
+  				EBADMSG : Received frame is not valid \n
+  				ECONNRESET : Socket is closed by peer before whole frame is received \n
+  				ENOMEM : No memory \n
+  				Or, errno set by recvmsg().
+ @code
+ #include <bundle.h>
+ bundle *b;
+ if(0 == bundle_recv(sock, &b)) {
+ 	bundle_free(b);
+ }
+ @endcode
+ */
+API int				bundle_recv(int fd, bundle **b);
+
+/**
+ * @brief	Encode bundle to bundle_raw format, into a buffer shared with the bundle
+ * @pre			b must be a valid bundle object.
+ * @post		r is valid until b is modified or freed. DO NOT free or modify r.
+ * @see			bundle_encode()
+ * @param[in]	b	bundle object
+ * @param[out]	r	returned bundle_raw data(byte data), owned by b
+ * @param[out]	len	size of r (in bytes)
+ * @return	Operation result
+ * @retval		0		Success
+ * @retval		-1		Failure
+ * @remark		Encoded result is cached in b. While b is not modified, this returns the cached result
+  				without encoding again, and so does bundle_encode() with a copy of it. \n
+  				When -1 is returned, errno is set to one of the following values; \n
+  				EINVAL : b or r is invalid (NULL) \n
+  				ENOMEM : No memory \n
+ @code
+ #include <bundle.h>
+ const bundle_raw *r;
+ int len;
+ for(i = 0; i < n_subscribers; i++) {
+	 bundle_encode_shared(b, &r, &len);	// Encoded only once
+	 send_to(subscribers[i], r, len);
+ }
+ @endcode
+ */
+API int				bundle_encode_shared(bundle *b, const bundle_raw **r, int *len);
+
+/**
+ * @brief	Set whether encoded keyvals are kept in a bundle, for incremental re-encoding
+ * @pre			b must be a valid bundle object.
+ * @post		None
+ * @see			bundle_encode()
+ * @see			bundle_encode_shared()
+ * @param[in]	b	bundle object
+ * @param[in]	enable	1 to keep encoded keyvals, 0 to drop them
+ * @return	Operation result
+ * @retval		0		Success
+ * @retval		-1		Failure
+ * @remark		When enabled, each keyval keeps its encoded bytes after encoding, until its value is changed.
+  				Next encoding copies them, and encodes only added or changed keyvals.
+  				It costs memory for a copy of encoded keyvals. Use it for a long-lived bundle, which is modified a few keys at a time and encoded again.
+  				Checksum and base64 are still computed over the whole data, as bundle_raw format requires. \n
+  				When -1 is returned, errno is set to one of the following values; \n
+  				EINVAL : b is invalid (NULL) \n
+ */
+API int				bundle_set_incremental_encode(bundle *b, int enable);
+
+/**
+ * @brief	Encode keyvals selected by a filter to bundle_raw format
+ * @pre			b must be a valid bundle object.
+ * @post		None
+ * @see			bundle_encode()
+ * @see			bundle_project()
+ * @param[in]	b	bundle object
+ * @param[in]	filter	function to select keyvals. If NULL, all keyvals are encoded.
+ * @param[in]	user_data	data for filter
+ * @param[out]	r	returned bundle_raw data(byte data)
+ *					r MUST BE FREED by free(r).
+ * @param[out]	len	size of r (in bytes)
+ * @return	Operation result
+ * @retval		0		Success
+ * @retval		-1		Failure
+ * @remark		Selected keyvals are encoded directly from b, without an intermediate bundle.
+  				filter is called once for each keyval. \n
+  				When -1 is returned, errno is set to one of the following values; \n
+  				EINVAL : b is invalid (NULL) \n
+  				ENOMEM : No memory \n
+ */
+API int				bundle_encode_filtered(bundle *b, bundle_filter_t filter, void *user_data, bundle_raw **r, int *len);
+
+/**
+ * @brief	Get size of bundle_raw data which bundle_encode() makes from a bundle
+ * @pre			b must be a valid bundle object.
+ * @post		None
+ * @see			bundle_encode()
+ * @param[in]	b	bundle object
+ * @return	Same value as len of bundle_encode(), without terminating null byte
+ * @retval		-1		Failure
+ * @remark		Sizes of encoded keyvals are cached in them, so this costs a sum over the keyvals.
+  				Use this to preallocate a transport buffer. \n
+  				When -1 is returned, errno is set to one of the following values; \n
+  				EINVAL : b is invalid (NULL) \n
+ */
+API int				bundle_get_encoded_size(bundle *b);
 
 /**
  * @brief	Free encoded rawdata from memory
@@ -528,7 +1646,11 @@ API int				bundle_free_encoded_rawdata(bundle_raw **r);
  * @param[in]	len	size of r
  * @return	bundle object
  * @retval	NULL	Failure
- * @remark		None
+ * @remark		Sizes of all key/values in r are checked before they are decoded. \n
+  				When NULL is returned, errno is set to one of the following values; \n
+  				EINVAL : r is invalid \n
+  				EBADMSG : checksum of r is not valid, or r is broken \n
+  				ENOMEM : No memory \n
  @code
  #include <bundle.h>
  bundle *b = bundle_create(); // Create new bundle object
@@ -548,6 +1670,110 @@ API int				bundle_free_encoded_rawdata(bundle_raw **r);
  */
 API bundle *		bundle_decode(const bundle_raw *r, const int len);
 
+/**
+ * @brief	Decode bundle_raw into an existing bundle, reusing its memory
+ * @pre			b must be a valid bundle object. r must be a valid bundle_raw data.
+ * @post		b has only the key/values decoded from r.
+ * @see			bundle_decode()
+ * @see			bundle_clear()
+ * @param[in]	b	bundle object
+ * @param[in]	r	bundle_raw data to be decoded
+ * @param[in]	len	size of r
+ * @return	Operation result
+ * @retval		0		Success
+ * @retval		-1		Failure
+ * @remark		Old key/values of b are cleared, and their memory is reused for the new ones. Value buffers are reused when they are large enough.
+  				Decoding many bundle_raw data into one bundle from bundle_create_with_capacity() avoids most of allocations. \n
+  				When -1 is returned, b is not changed, and errno is set to one of the following values; \n
+  				EINVAL : b or r is invalid \n
+  				EBADMSG : checksum of r is not valid, or r is broken \n
+  				EROFS : b is read-only \n
+ @code
+ #include <bundle.h>
+ bundle *b = bundle_create_with_capacity(16);
+ while(recv_raw(&r, &len)) {
+ 	bundle_decode_into(b, r, len);
+ 	handle(b);
+ }
+ bundle_free(b);
+ @endcode
+ */
+API int				bundle_decode_into(bundle *b, const bundle_raw *r, const int len);
+
+/**
+ * @brief	Decode only given keys of bundle_raw
+ * @pre			r must be a valid bundle_raw data.
+ * @post		Returned bundle must be freed by bundle_free().
+ * @see			bundle_decode()
+ * @see			bundle_project_keys()
+ * @param[in]	r	bundle_raw data to be decoded
+ * @param[in]	len	size of r
+ * @param[in]	keys	array of keys to be decoded. NULL items are ignored.
+ * @param[in]	n_keys	number of items in keys
+ * @return	bundle object which has only key/values of given keys
+ * @retval	NULL	Failure
+ * @remark		Other key/values are skipped by their encoded size, without being decoded or copied. Missing keys are ignored.
+  				Sizes of scanned key/values are checked, and broken data fails as a whole. \n
+  				When NULL is returned, errno is set to one of the following values; \n
+  				EINVAL : r or keys is invalid \n
+  				EBADMSG : checksum of r is not valid, or r is broken \n
+  				ENOMEM : No memory \n
+ @code
+ #include <bundle.h>
+ const char *keys[] = { "__APP_ID__", "__OPERATION__" };
+ bundle *b = bundle_decode_keys(r, len, keys, 2);
+ bundle_free(b);
+ @endcode
+ */
+API bundle *		bundle_decode_keys(const bundle_raw *r, const int len, const char **keys, const int n_keys);
+
+/**
+ * @brief	Set the number of decoded bundles kept by bundle_decode_cached()
+ * @pre			None
+ * @post		Least recently used bundles out of size are dropped from cache.
+ * @see			bundle_decode_cached()
+ * @param[in]	size	maximum number of cached bundles. 0 disables cache, which is the default.
+ * @return	Operation result
+ * @retval		0		Success
+ * @retval		-1		Failure
+ * @remark		The cache is process-wide, and thread-safe. \n
+  				When -1 is returned, errno is set to one of the following values; \n
+  				EINVAL : size is negative \n
+  				ENOMEM : No memory \n
+ */
+API int				bundle_decode_cache_set_size(int size);
+
+/**
+ * @brief	Decode bundle_raw to a read-only bundle, reusing a cached one for the same data
+ * @pre			r must be a valid bundle_raw data
+ * @post		Release the returned bundle with bundle_free().
+ * @see			bundle_decode()
+ * @see			bundle_decode_cache_set_size()
+ * @see			bundle_dup()
+ * @param[in]	r	bundle_raw data to be converted to bundle object
+ * @param[in]	len	size of r
+ * @return	A read-only bundle object
+ * @retval	NULL	Failure
+ * @remark		If the same data is decoded recently, the cached bundle is returned without decoding again.
+  				Returned bundle may be shared with other callers, and it can not be modified.
+  				Functions which modify it fail with errno EROFS. To modify it, make a copy with bundle_dup().
+  				bundle_encode() of the returned bundle just copies r.
+  				Cached bundles are looked up by the checksum in r. Like bundle_decode(), r is read up to its end, and len is not used. \n
+  				When NULL is returned, errno is set to one of the following values; \n
+  				EINVAL : r is invalid \n
+  				EBADMSG : checksum of r is not valid, or r is broken \n
+  				ENOMEM : No memory \n
+ @code
+ #include <bundle.h>
+ bundle_decode_cache_set_size(16);	// Once
+
+ bundle *b = bundle_decode_cached(r, len);	// Decoded only once for the same r
+ const char *val = bundle_get_val(b, "foo_key");
+ bundle_free(b);
+ @endcode
+ */
+API bundle *		bundle_decode_cached(const bundle_raw *r, const int len);
+
 
 /**
  * @brief	Export bundle to argv
@@ -637,43 +1863,104 @@ API int				bundle_free_exported_argv(int argc, char ***argv);
  */
 API bundle *		bundle_import_from_argv(int argc, char **argv);
 
-#if 0
 /**
- * @brief		Add a string type key-value pair into bundle. 
- * @pre			b must be a valid bundle object.
- * @post		None
- * @see			bundle_get_str()
- * @param[in]	b	bundle object
- * @param[in]	key	key
- * @param[in]	str string type value
- * @return		Operation result
- * @retval		0	success
- * @retval		-1	failure
- *
- * @remark		When -1 is returned, errno is set to one of the following values; \n
-  				EKEYREJECTED : key is rejected (NULL or sth) \n
- 				EPERM : key is already exist, not permitted to overwrite value \n
-  				EINVAL : b or val is not valid (NULL or sth) \n
+ * @brief	Move all key-value pairs of src into dst
+ * @pre		dst and src must be valid bundle objects.
+ * @post	Merged pairs are moved out of src. src must still be freed by bundle_free().
+ * @see		bundle_merge_policy
+ * @param[in]	dst	bundle object to merge into
+ * @param[in]	src	bundle object to merge from
+ * @param[in]	policy	what to do with a key existing in both, one of bundle_merge_policy
+ * @return	Operation result
+ * @retval	0	Success
+ * @retval	-1	Failure
+ * @remark	Keyvals are moved without copying, with one hash lookup per key.
+ 			With BUNDLE_MERGE_KEEP, pairs which are not merged stay in src. \n
+ 			When -1 is returned, errno is set to one of the following values; \n
+ 			EINVAL : dst, src or policy is not valid \n
+ 			EPERM : A key exists in both, with BUNDLE_MERGE_FAIL. Neither bundle is changed. \n
  @code
  #include <bundle.h>
- bundle *b = bundle_create(); // Create new bundle object
- bundle_add_str(b, "foo", "bar"); // add a key-val pair
+ bundle *tmpl = bundle_create();
+ bundle_add(tmpl, "k1", "default");
+ bundle_add(tmpl, "k2", "default");
 
- bundle_free(b);
+ bundle *req = bundle_create();
+ bundle_add(req, "k1", "request");
+
+ bundle_merge(tmpl, req, BUNDLE_MERGE_OVERWRITE);	// tmpl = { "k1":"request", "k2":"default" }, req is empty
+
+ bundle_free(req);
+ bundle_free(tmpl);
  @endcode
  */
-API int bundle_add_str(bundle *b, const char *key, const char *str);
+API int				bundle_merge(bundle *dst, bundle *src, int policy);
 
 /**
- * @brief		Set a value of string array element
+ * @brief	Make a delta which turns b_old into b_new
+ * @pre		b_old and b_new must be valid bundle objects.
+ * @post	delta must be freed by free().
+ * @see		bundle_patch
+ * @param[in]	b_old	base bundle object
+ * @param[in]	b_new	changed bundle object
+ * @param[out]	delta	encoded delta (bundle_raw format)
+ * @param[out]	len	size of delta (in bytes)
+ * @return	Operation result
+ * @retval	0	Success
+ * @retval	-1	Failure
+ * @remark	The delta has only keys added, removed or changed in b_new, so its size is proportional to the change.
+ 			When -1 is returned, errno is set to one of the following values; \n
+ 			EINVAL : b_old, b_new or delta is not valid (NULL or sth) \n
+ 			ENOMEM : No memory to make a delta \n
+ @code
+ #include <bundle.h>
+ bundle *b1 = bundle_create();
+ bundle_add(b1, "k1", "v1");
+ bundle *b2 = bundle_dup(b1);
+ bundle_del(b2, "k1");
+ bundle_add(b2, "k2", "v2");
+
+ bundle_raw *delta;
+ int len;
+ bundle_diff(b1, b2, &delta, &len);	// delta = { -"k1", +"k2" }
+ bundle_patch(b1, delta, len);	// now b1 is same to b2
+
+ free(delta);
+ bundle_free(b1);
+ bundle_free(b2);
+ @endcode
+ */
+API int				bundle_diff(bundle *b_old, bundle *b_new, bundle_raw **delta, int *len);
+
+/**
+ * @brief	Apply a delta made by bundle_diff() to a bundle
+ * @pre		b must be a valid bundle object, and delta must be made by bundle_diff().
+ * @post	Keys in delta are added, replaced or deleted in b.
+ * @see		bundle_diff
+ * @param[in]	b	bundle object to be patched
+ * @param[in]	delta	encoded delta
+ * @param[in]	len	size of delta
+ * @return	Operation result
+ * @retval	0	Success
+ * @retval	-1	Failure
+ * @remark	Whole delta is checked and decoded before b is changed. \n
+ 			When -1 is returned, b is not changed, and errno is set to one of the following values; \n
+ 			EINVAL : b or delta is not valid (NULL or sth) \n
+ 			EBADMSG : delta is corrupted \n
+ 			EROFS : b is read-only \n
+ 			ENOMEM : No memory \n
+ */
+API int				bundle_patch(bundle *b, const bundle_raw *delta, const int len);
+
+/**
+ * @brief		Add a byte type key-value pair into bundle. 
  * @pre			b must be a valid bundle object.
  * @post		None
- * @see			bundle_add_str_array()
- * @see			bundle_get_str_array()
+ * @see			bundle_get_byte()
  * @param[in]	b	bundle object
  * @param[in]	key	key
- * @param[in]	idx index of array element to be changed
- * @param[in]	val string type value. If NULL, empty array is created. You can change an item with 
+ * @param[in]	byte string type value
+ * @param[in]	size size of byte
  * @return		Operation result
  * @retval		0	success
  * @retval		-1	failure
@@ -684,50 +1971,46 @@ API int bundle_add_str(bundle *b, const char *key, const char *str);
   				EINVAL : b or val is not valid (NULL or sth) \n
  @code
  #include <bundle.h>
- bundle *b = bundle_create();
- bundle_add_str_array(b, "foo", NULL, 3); // add a key-val pair
- bundle_set_str_array_element(b, "foo", 0, "aaa");
- bundle_set_str_array_element(b, "foo", 1, "bbb");
- bundle_set_str_array_element(b, "foo", 2, "ccc");
-
- char **str_array = NULL;
- int len_str_array = 0;
-
- str_array=bundle_get_str_array(b, "foo", &len_str_array);
- // str_array = { "aaa", "bbb", "ccc" }, and len_str_array = 3
+ bundle *b = bundle_create(); // Create new bundle object
+ bundle_add_byte(b, "foo", "bar\0", 4); // add a key-val pair
 
  bundle_free(b);
  @endcode
  */
-API int bundle_set_str_array_element(bundle *b, const char *key, const unsigned int idx, const char *val);
+
+API int bundle_add_byte(bundle *b, const char *key, const void *byte, const size_t size);
 
 /**
- * @brief		Add a byte type key-value pair into bundle. 
+ * @brief		Add a byte type key-value pair into bundle, taking the ownership of byte without copying it.
  * @pre			b must be a valid bundle object.
- * @post		None
+ * @post		On success, byte belongs to b. DO NOT free or modify byte.
+ * @see			bundle_add_byte()
  * @see			bundle_get_byte()
  * @param[in]	b	bundle object
  * @param[in]	key	key
- * @param[in]	byte string type value
- * @param[in]	size size of byte
+ * @param[in]	byte	value buffer
+ * @param[in]	size	size of byte
+ * @param[in]	free_fn	function to free byte when b does not need it any more. If NULL, byte is not freed, and it must outlive b.
  * @return		Operation result
  * @retval		0	success
  * @retval		-1	failure
  *
- * @remark		When -1 is returned, errno is set to one of the following values; \n
+ * @remark		On failure, byte still belongs to the caller. \n
+  				When -1 is returned, errno is set to one of the following values; \n
   				EKEYREJECTED : key is rejected (NULL or sth) \n
  				EPERM : key is already exist, not permitted to overwrite value \n
-  				EINVAL : b or val is not valid (NULL or sth) \n
+  				EINVAL : b or byte is not valid (NULL or sth) \n
  @code
  #include <bundle.h>
- bundle *b = bundle_create(); // Create new bundle object
- bundle_add_byte(b, "foo", "bar\0", 4); // add a key-val pair
+ bundle *b = bundle_create();
+ void *thumbnail = malloc(size);
+ // fill thumbnail...
+ bundle_add_byte_nocopy(b, "thumbnail", thumbnail, size, free);	// thumbnail is not copied
 
- bundle_free(b);
+ bundle_free(b);	// thumbnail is freed by free()
  @endcode
  */
-
-API int bundle_add_byte(bundle *b, const char *key, const void *byte, const size_t size);
+API int bundle_add_byte_nocopy(bundle *b, const char *key, void *byte, const size_t size, bundle_free_func_t free_fn);
 
 /**
  * @brief		Add a byte array type key-value pair into bundle. 
@@ -788,10 +2071,10 @@ API int bundle_add_byte_array(bundle *b, const char *key, void **byte_array, con
  bundle_set_byte_array_element(b, "foo", 1, "bbb\0", 4);
  bundle_set_byte_array_element(b, "foo", 2, "ccc\0", 4);
 
- unsigned char **byte_array = NULL;
- int len_byte_array = 0;
+ void **byte_array = NULL;
+ unsigned int len_byte_array = 0;
 
- byte_array=bundle_get_str_array(b, "foo", &len_byte_array);
+ bundle_get_byte_array(b, "foo", &byte_array, &len_byte_array, NULL);
  // byte_array = { "aaa\0", "bbb\0", "ccc\0" }, and len_byte_array = 3
 
  bundle_free(b);
@@ -800,13 +2083,14 @@ API int bundle_add_byte_array(bundle *b, const char *key, void **byte_array, con
 API int bundle_set_byte_array_element(bundle *b, const char *key, const unsigned int idx, const void *val, const size_t size);
 
 /**
- * @brief		Get string value from key
+ * @brief		Get byte value from key
  * @pre			b must be a valid bundle object.
  * @post		None
- * @see			bundle_add_str()
+ * @see			bundle_add_byte()
  * @param[in]	b	bundle object
  * @param[in]	key	key
- * @param[out]	str returned value
+ * @param[out]	byte returned value
+ * @param[out]	size Size of byte
  * @return		Operation result
  * @retval		0 on success
  * @retval		-1 on failure
@@ -818,26 +2102,28 @@ API int bundle_set_byte_array_element(bundle *b, const char *key, const unsigned
  @code
  #include <bundle.h>
  bundle *b = bundle_create(); // Create new bundle object
- bundle_add_str(b, "foo_key", "bar_val"); // add a key-val pair
+ bundle_add_byte(b, "foo", "bar\0", 4); // add a key-val pair
 
- char *v = NULL;
- bundle_get_str(b, "foo_key", &v);	// v = "bar_val"
+ unsigned char *v = NULL;
+ size_t size = 0;
+ bundle_get_byte(b, "foo", &v, &size);	// v = "bar\0", size = 4
 
  bundle_free(b);	// After freeing b, v becomes a dangling pointer.
- v = NULL;
  @endcode
  */
-API int bundle_get_str(bundle *b, const char *key, char **str);
+API int bundle_get_byte(bundle *b, const char *key, void **byte, size_t *size);
 
 /**
- * @brief		Get byte value from key
+ * @brief		Get byte array value from key
  * @pre			b must be a valid bundle object.
  * @post		None
- * @see			bundle_add_byte()
+ * @see			bundle_add_byte_array()
+ * @see			bundle_set_byte_array_element()
  * @param[in]	b	bundle object
  * @param[in]	key	key
- * @param[out]	byte returned value
- * @param[out]	size Size of byte
+ * @param[out]	byte_array returned value
+ * @param[out]	len	array length
+ * @param[out]	array_element_size	an array of sizes of each byte_array element
  * @return		Operation result
  * @retval		0 on success
  * @retval		-1 on failure
@@ -848,28 +2134,96 @@ API int bundle_get_str(bundle *b, const char *key, char **str);
   				EKEYREJECTED : invalid key (NULL or sth) \n
  @code
  #include <bundle.h>
- bundle *b = bundle_create(); // Create new bundle object
- bundle_add_byte(b, "foo", "bar\0", 4); // add a key-val pair
+ bundle *b = bundle_create();
+ bundle_add_byte_array(b, "foo", NULL, 3);
+ bundle_set_byte_array_element(b, "foo", 0, "aaa\0", 4);
+ bundle_set_byte_array_element(b, "foo", 1, "bbb\0", 4);
+ bundle_set_byte_array_element(b, "foo", 2, "ccc\0", 4);
 
- unsigned char *v = NULL;
- bundle_get_str(b, "foo", &v);	// v = "bar\0"
+ void **byte_array = NULL;
+ unsigned int len_byte_array = 0;
+ size_t *size_byte_array = NULL;
 
- bundle_free(b);	// After freeing b, v becomes a dangling pointer.
+ bundle_get_byte_array(b, "foo", &byte_array, &len_byte_array, &size_byte_array);
+ // byte_array = { "aaa\0", "bbb\0", "ccc\0" }, len_byte_array = 3, and size_byte_array = { 4, 4, 4 }
+
+ bundle_free(b);
  @endcode
  */
-API int bundle_get_byte(bundle *b, const char *key, void **byte, size_t *size);
+API int bundle_get_byte_array(bundle *b, const char *key, void ***byte_array, unsigned int *len, size_t **array_element_size);
 
+#if 0
 /**
- * @brief		Get byte array value from key
+ * @brief		Add a string type key-value pair into bundle. 
+ * @pre			b must be a valid bundle object.
+ * @post		None
+ * @see			bundle_get_str()
+ * @param[in]	b	bundle object
+ * @param[in]	key	key
+ * @param[in]	str string type value
+ * @return		Operation result
+ * @retval		0	success
+ * @retval		-1	failure
+ *
+ * @remark		When -1 is returned, errno is set to one of the following values; \n
+  				EKEYREJECTED : key is rejected (NULL or sth) \n
+ 				EPERM : key is already exist, not permitted to overwrite value \n
+  				EINVAL : b or val is not valid (NULL or sth) \n
+ @code
+ #include <bundle.h>
+ bundle *b = bundle_create(); // Create new bundle object
+ bundle_add_str(b, "foo", "bar"); // add a key-val pair
+
+ bundle_free(b);
+ @endcode
+ */
+API int bundle_add_str(bundle *b, const char *key, const char *str);
+
+/**
+ * @brief		Set a value of string array element
  * @pre			b must be a valid bundle object.
  * @post		None
  * @see			bundle_add_str_array()
- * @see			bundle_set_str_array_element()
+ * @see			bundle_get_str_array()
  * @param[in]	b	bundle object
  * @param[in]	key	key
- * @param[out]	byte_array returned value
- * @param[out]	len	array length
- * @param[out]	array_element_size	an array of sizes of each byte_array element
+ * @param[in]	idx index of array element to be changed
+ * @param[in]	val string type value. If NULL, empty array is created. You can change an item with 
+ * @return		Operation result
+ * @retval		0	success
+ * @retval		-1	failure
+ *
+ * @remark		When -1 is returned, errno is set to one of the following values; \n
+  				EKEYREJECTED : key is rejected (NULL or sth) \n
+ 				EPERM : key is already exist, not permitted to overwrite value \n
+  				EINVAL : b or val is not valid (NULL or sth) \n
+ @code
+ #include <bundle.h>
+ bundle *b = bundle_create();
+ bundle_add_str_array(b, "foo", NULL, 3); // add a key-val pair
+ bundle_set_str_array_element(b, "foo", 0, "aaa");
+ bundle_set_str_array_element(b, "foo", 1, "bbb");
+ bundle_set_str_array_element(b, "foo", 2, "ccc");
+
+ char **str_array = NULL;
+ int len_str_array = 0;
+
+ str_array=bundle_get_str_array(b, "foo", &len_str_array);
+ // str_array = { "aaa", "bbb", "ccc" }, and len_str_array = 3
+
+ bundle_free(b);
+ @endcode
+ */
+API int bundle_set_str_array_element(bundle *b, const char *key, const unsigned int idx, const char *val);
+
+/**
+ * @brief		Get string value from key
+ * @pre			b must be a valid bundle object.
+ * @post		None
+ * @see			bundle_add_str()
+ * @param[in]	b	bundle object
+ * @param[in]	key	key
+ * @param[out]	str returned value
  * @return		Operation result
  * @retval		0 on success
  * @retval		-1 on failure
@@ -880,23 +2234,18 @@ API int bundle_get_byte(bundle *b, const char *key, void **byte, size_t *size);
   				EKEYREJECTED : invalid key (NULL or sth) \n
  @code
  #include <bundle.h>
- bundle *b = bundle_create();
- bundle_add_byte_array(b, "foo", NULL, 3);
- bundle_set_byte_array_element(b, "foo", 0, "aaa\0", 4);
- bundle_set_byte_array_element(b, "foo", 1, "bbb\0", 4);
- bundle_set_byte_array_element(b, "foo", 2, "ccc\0", 4);
-
- char **byte_array = NULL;
- int len_byte_array = 0;
- size_t *size_byte_array = NULL;
+ bundle *b = bundle_create(); // Create new bundle object
+ bundle_add_str(b, "foo_key", "bar_val"); // add a key-val pair
 
- byte_array = bundle_get_str_array(b, "foo", &len_byte_array, &size_byte_array);
- // byte_array = { "aaa\0", "bbb\0", "ccc\0" }, len_byte_array = 3, and size_byte_array = { 4, 4, 4 }
+ char *v = NULL;
+ bundle_get_str(b, "foo_key", &v);	// v = "bar_val"
 
- bundle_free(b);
+ bundle_free(b);	// After freeing b, v becomes a dangling pointer.
+ v = NULL;
  @endcode
  */
-API int bundle_get_byte_array(bundle *b, const char *key, void ***byte_array, unsigned int *len, unsigned int **array_element_size);
+API int bundle_get_str(bundle *b, const char *key, char **str);
+
 #endif
 
 
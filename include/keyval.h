@@ -31,6 +31,7 @@
  */
 
 #include <stddef.h>
+#include <stdint.h>
 
 // ADT: object
 typedef struct keyval_t keyval_t;
@@ -38,6 +39,7 @@ typedef struct keyval_t keyval_t;
 // Object methods
 typedef struct keyval_method_collection_t keyval_method_collection_t;
 
+typedef void (*keyval_free_func_t)(void *ptr);
 typedef void (*keyval_method_free_t)(keyval_t *kv, int do_free_object);
 typedef int (*keyval_method_compare_t) (keyval_t *kv1, keyval_t *kv2);
 typedef size_t (*keyval_method_get_encoded_size_t)(keyval_t *kv);
@@ -57,10 +59,23 @@ struct keyval_method_collection_t
 struct keyval_t
 {
 	int type;
-	char *key;	// To be freed.
+	char *key;	// Interned key. Immutable, and released with keyval_key_unref().
+	char *recycled_key;	// Key of a reset keyval, kept until reused, so that the same key is not interned again.
 	void *val;	// To be freed.
 	size_t size;	// Size of a single value.
+	size_t capacity;	// Allocated size of val. val is reused while a new value fits.
+	size_t encoded_size;	// Cached size of encoded keyval. 0 if not computed yet.
+	unsigned char *encoded;	// Cached encoded keyval, of encoded_size bytes. NULL if not kept.
+	union {
+		int64_t i64;
+		double d;
+		int b;
+	} primitive_val;	// Value of a primitive type is stored here, and val points it.
+	keyval_free_func_t val_free;	// If not NULL, val is adopted from outside, and freed with this.
+	unsigned int hash;	// Hash of key
 	struct keyval_t *next;
+	struct keyval_t *prev;
+	struct keyval_t *hash_next;	// Next kv in the same bucket of bundle index
 
 	keyval_method_collection_t *method;
 
@@ -68,13 +83,23 @@ struct keyval_t
 
 
 keyval_t * keyval_new(keyval_t *kv, const char *key, const int type, const void *val, const size_t size);
+keyval_t * keyval_new_interned(keyval_t *kv, const char *ikey, const int type, const void *val, const size_t size);
+keyval_t * keyval_new_take(keyval_t *kv, char *key, const int type, void *val, const size_t size, keyval_free_func_t free_func);
 void keyval_free(keyval_t *kv, int do_free_object);
+void keyval_reset(keyval_t *kv, size_t max_capacity);
 int keyval_compare(keyval_t *kv1, keyval_t *kv2);
 size_t keyval_get_encoded_size(keyval_t *kv);
 size_t keyval_encode(keyval_t *kv, unsigned char **byte, size_t *byte_len);
 size_t keyval_decode(unsigned char *byte, keyval_t **kv);
 int keyval_get_data(keyval_t *kv, int *type, void **val, size_t *size);
+int keyval_set_val(keyval_t *kv, const void *val, const size_t size);
+void keyval_adopt_val(keyval_t *kv, void *val, const size_t size, keyval_free_func_t val_free);
+void keyval_free_nothing(void *ptr);
+void keyval_set_dirty(keyval_t *kv);
 int keyval_get_type_from_encoded_byte(unsigned char *byte);
+unsigned int keyval_hash_key(const char *key);
+size_t keyval_get_byte_len_from_encoded_byte(unsigned char *byte);
+char *keyval_get_key_from_encoded_byte(unsigned char *byte);
 
 #endif /* __KEYVAL_H__ */
 
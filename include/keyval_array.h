@@ -36,12 +36,15 @@ typedef struct keyval_array_t
 	
 	unsigned int len;	// length of array_val
 	size_t  *array_element_size;	// Array of size of each element
+	size_t  *array_element_capacity;	// Array of allocated size of each element. Kept only after keyval_array_set_array(), otherwise NULL.
 	void **array_val;	// Array
+	keyval_free_func_t array_free;	// If not NULL, array_val and its items are adopted from outside, and freed with this.
 
 } keyval_array_t;
 
 
 keyval_array_t *keyval_array_new(keyval_array_t *kva, const char *key, const int type, const void **array_val, const unsigned int len);
+keyval_array_t *keyval_array_new_take(keyval_array_t *kva, char *key, const int type, void **array_val, const unsigned int len, keyval_free_func_t free_func);
 void keyval_array_free(keyval_array_t *kva, int do_free_object);
 int keyval_array_compare(keyval_array_t *kva1, keyval_array_t *kva2);
 size_t keyval_array_get_encoded_size(keyval_array_t *kva);
@@ -49,4 +52,6 @@ size_t keyval_array_encode(keyval_array_t *kva, void **byte, size_t *byte_len);
 size_t keyval_array_decode(void *byte, keyval_array_t **kva);
 int keyval_array_copy_array(keyval_array_t *kva, void **array_val, unsigned int array_len, size_t (*measure_val_len)(void * val));
 int keyval_array_get_data(keyval_array_t *kva, int *type,void ***array_val, unsigned int *len, size_t **array_element_size);
+int keyval_array_is_idx_valid(keyval_array_t *kva, int idx);
 int keyval_array_set_element(keyval_array_t *kva, int idx, void *val, size_t size);
+int keyval_array_set_array(keyval_array_t *kva, const void **array_val, const unsigned int len);
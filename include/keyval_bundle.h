@@ -0,0 +1,51 @@
+/*
+ * bundle
+ *
+ * Copyright (c) 2000 - 2011 Samsung Electronics Co., Ltd. All rights reserved.
+ *
+ * Contact: Jayoun Lee <airjany@samsung.com>, Sewook Park <sewook7.park@samsung.com>,
+ * Jaeho Lee <jaeho81.lee@samsung.com>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+
+
+
+#ifndef __KEYVAL_BUNDLE_H__
+#define __KEYVAL_BUNDLE_H__
+
+/**
+ * keyval_bundle.h
+ *
+ * keyval_bundle object
+ */
+
+#include "keyval.h"
+#include "bundle.h"
+
+
+typedef struct keyval_bundle_t
+{
+	struct keyval_t kv;		// Inherits keyval_t. val has encoded keyvals of child bundle.
+
+	bundle *child;	// Decoded child bundle. NULL until it is needed.
+
+} keyval_bundle_t;
+
+
+keyval_bundle_t *keyval_bundle_new(keyval_bundle_t *kvb, const char *key, const void *stream, const size_t size);
+void keyval_bundle_free(keyval_bundle_t *kvb, int do_free_object);
+size_t keyval_bundle_decode(unsigned char *byte, keyval_bundle_t **kvb);
+
+#endif /* __KEYVAL_BUNDLE_H__ */
@@ -0,0 +1,65 @@
+/*
+ * bundle
+ *
+ * Copyright (c) 2000 - 2011 Samsung Electronics Co., Ltd. All rights reserved.
+ *
+ * Contact: Jayoun Lee <airjany@samsung.com>, Sewook Park <sewook7.park@samsung.com>,
+ * Jaeho Lee <jaeho81.lee@samsung.com>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+
+
+
+#ifndef __KEYVAL_KEY_H__
+#define __KEYVAL_KEY_H__
+
+/**
+ * keyval_key.h
+ *
+ * Interned key table
+ * All keys of keyvals are interned in a process-wide table, and shared by keyvals.
+ * Two interned keys are equal if and only if their pointers are equal.
+ */
+
+#include <stddef.h>
+
+
+typedef struct keyval_key_t
+{
+	struct keyval_key_t *next;	// Next key in the same hash bucket
+
+	unsigned int hash;	// keyval_hash_key() of str
+	unsigned int ref;	// Reference count
+	size_t len;	// strlen(str)
+
+	char str[];	// Key string. Immutable.
+
+} keyval_key_t;
+
+
+const char *keyval_key_intern(const char *key);
+const char *keyval_key_ref(const char *key);
+void keyval_key_unref(const char *key);
+
+/**
+ * Get table entry of an interned key
+ */
+static inline keyval_key_t *
+keyval_key_get_entry(const char *key)
+{
+	return (keyval_key_t *)(key - offsetof(keyval_key_t, str));
+}
+
+#endif /* __KEYVAL_KEY_H__ */
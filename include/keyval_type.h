@@ -40,11 +40,15 @@ typedef size_t (*keyval_type_measure_size_func_t) (void *val);
 void _type_init_measure_size_func(void);
 int keyval_type_is_array(int type);
 int keyval_type_is_measurable(int type);
+int keyval_type_is_primitive(int type);
 keyval_type_measure_size_func_t keyval_type_get_measure_size_func(int type);
 
 
 /* Measure functions for each type */
 size_t keyval_type_measure_size_str(void *val);
+size_t keyval_type_measure_size_int64(void *val);
+size_t keyval_type_measure_size_double(void *val);
+size_t keyval_type_measure_size_bool(void *val);
 void keyval_type_init(void);
 
 #endif /* __KEYVAL_TYPE_H__ */
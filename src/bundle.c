@@ -26,25 +26,166 @@
  * bundle.c
  */
 
+#define _GNU_SOURCE		/* memfd_create, MSG_CMSG_CLOEXEC */
+
 #include "bundle.h"
 #include "keyval.h"
 #include "keyval_array.h"
+#include "keyval_bundle.h"
 #include "keyval_type.h"
+#include "keyval_key.h"
 #include "bundle_log.h"
 #include <glib.h>
 
 #include <stdlib.h>		/* calloc, free */
 #include <string.h>		/* strdup */
 #include <errno.h>
+#include <limits.h>		/* IOV_MAX */
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>		/* memfd_create */
+#include <sys/socket.h>
+#include <sys/stat.h>
 
 #define CHECKSUM_LENGTH 32
 #define TAG_IMPORT_EXPORT_CHECK "`zaybxcwdveuftgsh`"
+/* In a delta, a removed key is written as a keyval of this type, which no stored keyval has */
+#define DELTA_TYPE_REMOVED BUNDLE_TYPE_ANY
+#define INDEX_MIN_SIZE 16	/* Must be a power of 2 */
+#define POOL_VAL_MAX_CAPACITY 1024	/* Larger value buffers are not kept in pooled kvs */
 /* ADT */
 struct _bundle_t
 {
 	keyval_t *kv_head;
+	keyval_t *kv_tail;
+	int count;
+
+	/* Hash index of kvs by key. Chained with kv->hash_next. */
+	keyval_t **buckets;
+	unsigned int n_buckets;
+
+	/* Free kvs to be reused. Chained with kv->next. */
+	keyval_t *kv_pool;
+	keyval_t *kva_pool;
+	int kv_pool_len;
+	int kva_pool_len;
+	int pool_max;	/* Max length of each pool, which is the reserved capacity. More kvs are freed. */
+
+	/* kvs sorted by key, for prefix queries. Rebuilt lazily when keys are changed. */
+	keyval_t **sorted;
+	int sorted_size;	/* Allocated length of sorted */
+	int sorted_valid;
+
+	/* Modification counter. Bumped on every change of keys or values. */
+	unsigned long gen;
+
+	/* Cached result of bundle_encode_shared(). Valid while enc_gen == gen. */
+	bundle_raw *enc;
+	int enc_len;
+	unsigned long enc_gen;
+
+	/* If set, encoded kvs are kept in kv->encoded, and only changed kvs are encoded again. */
+	int keep_encoded;
+
+	/* Frozen bundle is read-only, and shared by references. See bundle_decode_cached(). */
+	int frozen;
+	int ref;	/* Guarded by decode_cache lock */
 };
 
+/* LRU cache of decoded bundles, for bundle_decode_cached() */
+typedef struct _decode_cache_entry_t {
+	struct _decode_cache_entry_t *prev;
+	struct _decode_cache_entry_t *next;
+	struct _decode_cache_entry_t *hash_next;	/* Chain in decode_cache_buckets */
+	unsigned int hash;	/* Hash of the checksum in encoded data */
+	bundle *b;	/* Frozen. b->enc is the encoded data, as the cache key. */
+} decode_cache_entry_t;
+
+G_LOCK_DEFINE_STATIC(decode_cache);
+static decode_cache_entry_t *decode_cache_head;	/* Most recently used */
+static decode_cache_entry_t *decode_cache_tail;
+static int decode_cache_count;
+static int decode_cache_size;	/* 0 means disabled */
+/* Hash index of entries by checksum. Power of 2 buckets, allocated while cache is enabled. */
+static decode_cache_entry_t **decode_cache_buckets;
+static unsigned int decode_cache_n_buckets;
+
+
+/**
+ * Rebuild hash index with n_buckets buckets
+ */
+static int
+_bundle_index_resize(bundle *b, unsigned int n_buckets)
+{
+	keyval_t **buckets;
+	keyval_t *kv;
+	unsigned int i;
+
+	buckets = calloc(n_buckets, sizeof(keyval_t *));
+	if(NULL == buckets) {
+		errno = ENOMEM;
+		return -1;
+	}
+
+	for(kv = b->kv_head; kv != NULL; kv = kv->next) {
+		i = kv->hash & (n_buckets - 1);
+		kv->hash_next = buckets[i];
+		buckets[i] = kv;
+	}
+
+	free(b->buckets);
+	b->buckets = buckets;
+	b->n_buckets = n_buckets;
+	return 0;
+}
+
+/**
+ * Make hash index large enough for count kvs
+ */
+static int
+_bundle_index_reserve(bundle *b, unsigned int count)
+{
+	unsigned int n_buckets = b->n_buckets ? b->n_buckets : INDEX_MIN_SIZE;
+
+	while(n_buckets < count) n_buckets <<= 1;
+	if(n_buckets == b->n_buckets) return 0;
+	return _bundle_index_resize(b, n_buckets);
+}
+
+static void
+_bundle_index_add(bundle *b, keyval_t *kv)
+{
+	keyval_t **bucket = &b->buckets[kv->hash & (b->n_buckets - 1)];
+
+	kv->hash_next = *bucket;
+	*bucket = kv;
+}
+
+static void
+_bundle_index_del(bundle *b, keyval_t *kv)
+{
+	keyval_t **p = &b->buckets[kv->hash & (b->n_buckets - 1)];
+
+	while(*p != kv) p = &(*p)->hash_next;
+	*p = kv->hash_next;
+	kv->hash_next = NULL;
+}
+
+/**
+ * Find a kv in hash index, with hash of key
+ */
+static keyval_t *
+_bundle_index_find(bundle *b, const char *key, unsigned int hash)
+{
+	keyval_t *kv;
+
+	kv = b->buckets[hash & (b->n_buckets - 1)];
+	while(kv != NULL) {
+		if(kv->hash == hash && (kv->key == key || 0 == strcmp(key, kv->key))) return kv;
+		kv = kv->hash_next;
+	}
+	return NULL;
+}
 
 /**
  * Find a kv from bundle
@@ -57,38 +198,323 @@ _bundle_find_kv(bundle *b, const char *key)
 	if(NULL == b) { errno  = EINVAL; return NULL; }
 	if(NULL == key) { errno = EKEYREJECTED; return NULL; }
 
-	kv = b->kv_head;
-	while (kv != NULL) {
-		if(0 == strcmp(key, kv->key)) return kv;
-		kv = kv->next;
-	} 
+	kv = _bundle_index_find(b, key, keyval_hash_key(key));
+	if(kv) return kv;
+
+	/* Not found */
+	errno = ENOKEY;
+	return NULL;
+}
+
+/**
+ * Find a kv from bundle, with a key handle
+ */
+static keyval_t *
+_bundle_find_kv_k(bundle *b, const bundle_key_t *k)
+{
+	keyval_t *kv;
+
+	if(NULL == b) { errno  = EINVAL; return NULL; }
+	if(NULL == k) { errno = EKEYREJECTED; return NULL; }
+
+	/* Keys are interned. No strcmp. */
+	kv = b->buckets[k->hash & (b->n_buckets - 1)];
+	while(kv != NULL) {
+		if(kv->key == k->str) return kv;
+		kv = kv->hash_next;
+	}
+
 	/* Not found */
 	errno = ENOKEY;
 	return NULL;
 }
 
+/**
+ * Get a free kv from pool
+ * @return	Cleared kv, or NULL if pool is empty.
+ */
+static keyval_t *
+_bundle_pool_get(bundle *b, int is_array)
+{
+	keyval_t **pool = is_array ? &b->kva_pool : &b->kv_pool;
+	keyval_t *kv = *pool;
+
+	if(kv) {
+		*pool = kv->next;
+		if(is_array) b->kva_pool_len--;
+		else b->kv_pool_len--;
+	}
+	return kv;
+}
+
+/**
+ * Give back a kv from _bundle_pool_get(), which is not used because creating a kv failed
+ * Constructors leave a given kv cleared on failure, so it is put back as it is.
+ */
+static void
+_bundle_pool_unget(bundle *b, keyval_t *kv, int is_array)
+{
+	if(NULL == kv) return;
+	if(is_array) {
+		kv->next = b->kva_pool;
+		b->kva_pool = kv;
+		b->kva_pool_len++;
+	}
+	else {
+		kv->next = b->kv_pool;
+		b->kv_pool = kv;
+		b->kv_pool_len++;
+	}
+}
+
+/**
+ * Put a kv, which is not in bundle any more, into pool
+ */
+static void
+_bundle_pool_put(bundle *b, keyval_t *kv)
+{
+	const char *key;
+
+	if(BUNDLE_TYPE_BUNDLE == kv->type) {
+		kv->method->free(kv, 1);	/* Not pooled */
+	}
+	else if(keyval_type_is_array(kv->type)) {
+		if(b->kva_pool_len >= b->pool_max) {
+			kv->method->free(kv, 1);
+			return;
+		}
+		key = keyval_key_ref(kv->key);	/* Kept like keyval_reset() */
+		kv->method->free(kv, 0);
+		memset(kv, 0, sizeof(keyval_array_t));
+		kv->recycled_key = (char *)key;
+		kv->next = b->kva_pool;
+		b->kva_pool = kv;
+		b->kva_pool_len++;
+	}
+	else {
+		if(b->kv_pool_len >= b->pool_max) {
+			kv->method->free(kv, 1);
+			return;
+		}
+		keyval_reset(kv, POOL_VAL_MAX_CAPACITY);
+		kv->next = b->kv_pool;
+		b->kv_pool = kv;
+		b->kv_pool_len++;
+	}
+}
+
+static void
+_bundle_pool_free(keyval_t *kv)
+{
+	keyval_t *tmp_kv;
+
+	while(kv != NULL) {
+		tmp_kv = kv;
+		kv = kv->next;
+		keyval_free(tmp_kv, 1);	/* Only its value buffer is left */
+	}
+}
+
+/**
+ * Check if bundle can be modified
+ */
+static inline int
+_bundle_check_writable(bundle *b)
+{
+	if(b && b->frozen) {
+		errno = EROFS;
+		return -1;
+	}
+	return 0;
+}
+
+/**
+ * Mark that a key or a value in bundle is changed
+ */
+static inline void
+_bundle_modified(bundle *b)
+{
+	b->gen++;
+}
+
+/**
+ * Mark that set of keys in bundle is changed
+ */
+static inline void
+_bundle_keys_changed(bundle *b)
+{
+	b->sorted_valid = 0;
+	_bundle_modified(b);
+}
+
 /**
  * Append kv into bundle
  */
 static int
 _bundle_append_kv(bundle *b, keyval_t *new_kv)
 {
-	keyval_t *kv;
+	/* On failure of growing, index just has longer chains. */
+	_bundle_index_reserve(b, b->count + 1);
 
+	new_kv->next = NULL;
+	new_kv->prev = b->kv_tail;
 	if (NULL == b->kv_head) b->kv_head = new_kv;
+	else b->kv_tail->next = new_kv;
+	b->kv_tail = new_kv;
+
+	_bundle_index_add(b, new_kv);
+	b->count++;
+	_bundle_keys_changed(b);
+	return 0;
+}
+
+/**
+ * Take kv out of bundle, without freeing it
+ */
+static void
+_bundle_unlink_kv(bundle *b, keyval_t *kv)
+{
+	if(kv->prev) kv->prev->next = kv->next;
+	else b->kv_head = kv->next;
+	if(kv->next) kv->next->prev = kv->prev;
+	else b->kv_tail = kv->prev;
+	kv->next = kv->prev = NULL;
+
+	_bundle_index_del(b, kv);
+	b->count--;
+	_bundle_keys_changed(b);
+}
+
+/**
+ * Replace old_kv in bundle with new_kv, keeping its position
+ */
+static void
+_bundle_replace_kv(bundle *b, keyval_t *old_kv, keyval_t *new_kv)
+{
+	new_kv->prev = old_kv->prev;
+	new_kv->next = old_kv->next;
+	if(new_kv->prev) new_kv->prev->next = new_kv;
+	else b->kv_head = new_kv;
+	if(new_kv->next) new_kv->next->prev = new_kv;
+	else b->kv_tail = new_kv;
+
+	_bundle_index_del(b, old_kv);
+	_bundle_index_add(b, new_kv);
+	_bundle_keys_changed(b);
+
+	_bundle_pool_put(b, old_kv);
+}
+
+static int
+_bundle_sorted_cmp(const void *kv1, const void *kv2)
+{
+	return strcmp((*(keyval_t **)kv1)->key, (*(keyval_t **)kv2)->key);
+}
+
+/**
+ * Get kvs sorted by key
+ * @return	Sorted array of b->count kvs, or NULL on failure
+ */
+static keyval_t **
+_bundle_get_sorted(bundle *b)
+{
+	keyval_t **sorted;
+	keyval_t *kv;
+	int i;
+
+	if(b->sorted_valid) return b->sorted;
+
+	if(b->sorted_size < b->count || NULL == b->sorted) {
+		sorted = realloc(b->sorted, (b->count ? b->count : 1) * sizeof(keyval_t *));
+		if(NULL == sorted) {
+			errno = ENOMEM;
+			return NULL;
+		}
+		b->sorted = sorted;
+		b->sorted_size = b->count;
+	}
+
+	for(i = 0, kv = b->kv_head; kv != NULL; kv = kv->next) b->sorted[i++] = kv;
+	qsort(b->sorted, b->count, sizeof(keyval_t *), _bundle_sorted_cmp);
+
+	b->sorted_valid = 1;
+	return b->sorted;
+}
+
+/**
+ * Find range of kvs whose keys start with prefix
+ * @return	Sorted kvs, with [*first, *last) as the range. NULL on failure.
+ */
+static keyval_t **
+_bundle_prefix_range(bundle *b, const char *prefix, int *first, int *last)
+{
+	keyval_t **sorted;
+	size_t len;
+	int lo, hi, mid;
+
+	if(NULL == b || NULL == prefix) {
+		errno = EINVAL;
+		return NULL;
+	}
+
+	sorted = _bundle_get_sorted(b);
+	if(NULL == sorted) return NULL;
+
+	/* Lower bound of prefix */
+	lo = 0;
+	hi = b->count;
+	while(lo < hi) {
+		mid = lo + (hi - lo) / 2;
+		if(strcmp(sorted[mid]->key, prefix) < 0) lo = mid + 1;
+		else hi = mid;
+	}
+
+	/* Matching keys are contiguous from there */
+	len = strlen(prefix);
+	for(hi = lo; hi < b->count && 0 == strncmp(sorted[hi]->key, prefix, len); hi++);
+
+	*first = lo;
+	*last = hi;
+	return sorted;
+}
+
+/**
+ * Create a new kv according to its type
+ */
+static keyval_t *
+_bundle_new_kv(bundle *b, const char *key, const void *val, const size_t size, const int type, const unsigned int len)
+{
+	keyval_t *new_kv = NULL;
+	keyval_t *pooled_kv;
+	if(keyval_type_is_array(type)) {
+		// array type
+		pooled_kv = _bundle_pool_get(b, 1);
+		new_kv = (keyval_t *)keyval_array_new((keyval_array_t *)pooled_kv, key, type, (const void **) val, len);
+		if(!new_kv) _bundle_pool_unget(b, pooled_kv, 1);
+	}
+	else if(BUNDLE_TYPE_BUNDLE == type) {
+		// bundle type. val is encoded child bundle.
+		new_kv = (keyval_t *)keyval_bundle_new(NULL, key, val, size);
+	}
 	else {
-		kv = b->kv_head;
-		while (NULL != kv->next) kv = kv->next;
-		kv->next = new_kv;
+		// normal type
+		pooled_kv = _bundle_pool_get(b, 0);
+		new_kv = keyval_new(pooled_kv, key, type, val, size);
+		if(!new_kv) _bundle_pool_unget(b, pooled_kv, 0);
 	}
-	return 0;
+	// NOTE: If NULL, errno is already set. (ENOMEM, ...)
+	return new_kv;
 }
 
+/**
+ * Check if key can be added into bundle
+ */
 static int
-_bundle_add_kv(bundle *b, const char *key, const void *val, const size_t size, const int type, const unsigned int len)
+_bundle_check_new_key(bundle *b, const char *key)
 {
 	/* basic value check */
 	if(NULL == b) { errno = EINVAL; return -1; }
+	if(_bundle_check_writable(b)) return -1;
 	if(NULL == key) { errno = EKEYREJECTED; return -1; }
 	if(0 == strlen(key)) { errno = EKEYREJECTED; return -1; }
 
@@ -99,16 +525,15 @@ _bundle_add_kv(bundle *b, const char *key, const void *val, const size_t size, c
 	}
 	errno = 0;
 
-	keyval_t *new_kv = NULL;
-	if(keyval_type_is_array(type)) {
-		// array type
-		keyval_array_t *kva = keyval_array_new(NULL, key, type, (const void **) val, len);
-		new_kv = (keyval_t *)kva;
-	}
-	else {
-		// normal type
-		new_kv = keyval_new(NULL, key, type, val, size);
-	}
+	return 0;
+}
+
+static int
+_bundle_add_kv(bundle *b, const char *key, const void *val, const size_t size, const int type, const unsigned int len)
+{
+	if(_bundle_check_new_key(b, key)) return -1;
+
+	keyval_t *new_kv = _bundle_new_kv(b, key, val, size, type, len);
 	if(!new_kv) {
 		// NOTE: errno is already set. (ENOMEM, ...)
 		return -1;
@@ -120,14 +545,48 @@ _bundle_add_kv(bundle *b, const char *key, const void *val, const size_t size, c
 
 }
 
+/**
+ * Add a kv, or replace value of existing kv with the same key
+ * Existing kv and its value buffer are reused if possible.
+ */
 static int
-_bundle_get_val(bundle *b, const char *key, const int type, void **val, size_t *size, unsigned int *len, size_t **array_element_size)
+_bundle_set_kv(bundle *b, const char *key, const void *val, const size_t size, const int type, const unsigned int len)
 {
-	keyval_t *kv = _bundle_find_kv(b, key);
-	if(!kv) {	/* Key doesn't exist */
-		/* NOTE: errno is already set. */
-		return -1;
+	keyval_t *kv, *new_kv;
+	int r;
+
+	/* basic value check */
+	if(NULL == b) { errno = EINVAL; return -1; }
+	if(_bundle_check_writable(b)) return -1;
+	if(NULL == key) { errno = EKEYREJECTED; return -1; }
+	if(0 == strlen(key)) { errno = EKEYREJECTED; return -1; }
+
+	kv = _bundle_find_kv(b, key);
+	errno = 0;
+
+	if(kv && kv->type == type) {
+		_bundle_modified(b);
+		if(keyval_type_is_array(type)) {
+			r = keyval_array_set_array((keyval_array_t *)kv, (const void **) val, len);
+		}
+		else {
+			r = keyval_set_val(kv, val, size);
+		}
+		return r ? -1 : 0;
 	}
+
+	new_kv = _bundle_new_kv(b, key, val, size, type, len);
+	if(!new_kv) return -1;
+
+	if(kv) _bundle_replace_kv(b, kv, new_kv);	/* Type is changed */
+	else _bundle_append_kv(b, new_kv);
+
+	return 0;
+}
+
+static int
+_bundle_get_kv_val(keyval_t *kv, const int type, void **val, size_t *size, unsigned int *len, size_t **array_element_size)
+{
 	if(BUNDLE_TYPE_ANY != type && type != kv->type) {
 		errno = ENOTSUP;
 		return -1;
@@ -144,6 +603,17 @@ _bundle_get_val(bundle *b, const char *key, const int type, void **val, size_t *
 	return 0;
 }
 
+static int
+_bundle_get_val(bundle *b, const char *key, const int type, void **val, size_t *size, unsigned int *len, size_t **array_element_size)
+{
+	keyval_t *kv = _bundle_find_kv(b, key);
+	if(!kv) {	/* Key doesn't exist */
+		/* NOTE: errno is already set. */
+		return -1;
+	}
+	return _bundle_get_kv_val(kv, type, val, size, len, array_element_size);
+}
+
 /** global initialization
  *  Run only once.
  */
@@ -176,6 +646,11 @@ bundle_create(void)
 		goto EXCEPTION;
 	}
 
+	if(_bundle_index_reserve(b, INDEX_MIN_SIZE)) {
+		BUNDLE_EXCEPTION_PRINT("Unable to allocate memory for bundle index\n");
+		goto EXCEPTION;
+	}
+
 	return b;
 
 EXCEPTION:
@@ -183,28 +658,116 @@ EXCEPTION:
 	return NULL;
 }
 
-int
-bundle_free(bundle *b)
+bundle *
+bundle_create_with_capacity(int capacity)
 {
-	keyval_t *kv, *tmp_kv; 
+	bundle *b;
+	keyval_t *kv;
+	int i;
 
-	if(NULL == b) {
-		BUNDLE_EXCEPTION_PRINT("Bundle is already freed\n");
+	if(0 > capacity) {
 		errno = EINVAL;
-		return -1;
+		return NULL;
 	}
 
-	/* Free keyval list */
-	kv = b->kv_head;
-	while(kv != NULL) {
-		tmp_kv = kv;
-		kv = kv->next;
-		tmp_kv->method->free(tmp_kv, 1);
-	}
+	b = bundle_create();
+	if(NULL == b) return NULL;
+
+	if(_bundle_index_reserve(b, capacity)) goto EXCEPTION;
+	b->pool_max = capacity;	/* Only reserved bundles keep free kvs */
+
+	for(i = 0; i < capacity; i++) {
+		kv = calloc(1, sizeof(keyval_t));
+		if(NULL == kv) {
+			errno = ENOMEM;
+			goto EXCEPTION;
+		}
+		kv->next = b->kv_pool;
+		b->kv_pool = kv;
+		b->kv_pool_len++;
+	}
+
+	return b;
+
+EXCEPTION:
+	BUNDLE_EXCEPTION_PRINT("Unable to allocate memory for bundle capacity\n");
+	bundle_free(b);
+	return NULL;
+}
+
+int
+bundle_clear(bundle *b)
+{
+	keyval_t *kv, *tmp_kv;
+
+	if(NULL == b) {
+		errno = EINVAL;
+		return -1;
+	}
+	if(_bundle_check_writable(b)) return -1;
+
+	/* From tail, so that kvs are reused in the same order by the next adds or decoding */
+	kv = b->kv_tail;
+	while(kv != NULL) {
+		tmp_kv = kv;
+		kv = kv->prev;
+		_bundle_pool_put(b, tmp_kv);
+	}
+
+	b->kv_head = b->kv_tail = NULL;
+	b->count = 0;
+	memset(b->buckets, 0, b->n_buckets * sizeof(keyval_t *));
+	_bundle_keys_changed(b);
+
+	return 0;
+}
+
+/**
+ * Free bundle object with key/values in it
+ */
+static void
+_bundle_destroy(bundle *b)
+{
+	keyval_t *kv, *tmp_kv; 
+
+	/* Free keyval list */
+	kv = b->kv_head;
+	while(kv != NULL) {
+		tmp_kv = kv;
+		kv = kv->next;
+		tmp_kv->method->free(tmp_kv, 1);
+	}
+
+	_bundle_pool_free(b->kv_pool);
+	_bundle_pool_free(b->kva_pool);
 
 	/* free bundle */
+	free(b->buckets);
+	free(b->sorted);
+	free(b->enc);
 	free(b);
+}
+
+int
+bundle_free(bundle *b)
+{
+	int ref;
+
+	if(NULL == b) {
+		BUNDLE_EXCEPTION_PRINT("Bundle is already freed\n");
+		errno = EINVAL;
+		return -1;
+	}
 
+	/* Frozen bundle is freed by its last reference */
+	if(b->frozen) {
+		G_LOCK(decode_cache);
+		ref = --b->ref;
+		G_UNLOCK(decode_cache);
+		if(ref) return 0;
+	}
+
+	_bundle_destroy(b);
 	return 0;
 }
 // str type
@@ -215,6 +778,32 @@ bundle_add_str(bundle *b, const char *key, const char *str)
 	return _bundle_add_kv(b, key, str, strlen(str)+1, BUNDLE_TYPE_STR, 1);
 }
 
+int
+bundle_add_str_take(bundle *b, char *key, char *str, bundle_free_func_t free_fn)
+{
+	keyval_t *pooled_kv, *new_kv;
+
+	if(!str) { errno = EINVAL; return -1; }
+	if(_bundle_check_new_key(b, key)) return -1;
+
+	pooled_kv = _bundle_pool_get(b, 0);
+	new_kv = keyval_new_take(pooled_kv, key, BUNDLE_TYPE_STR, str, strlen(str)+1, free_fn);
+	if(!new_kv) {
+		_bundle_pool_unget(b, pooled_kv, 0);
+		return -1;
+	}
+
+	_bundle_append_kv(b, new_kv);
+	return 0;
+}
+
+int
+bundle_set_str(bundle *b, const char *key, const char *str)
+{
+	if(!str) { errno = EINVAL; return -1; }
+	return _bundle_set_kv(b, key, str, strlen(str)+1, BUNDLE_TYPE_STR, 1);
+}
+
 int
 bundle_get_str(bundle *b, const char *key, char **str)
 {
@@ -230,29 +819,86 @@ bundle_add(bundle *b, const char *key, const char *val)
 int
 bundle_del(bundle *b, const char *key)
 {
-	keyval_t *kv = NULL, *prev_kv = NULL;
+	keyval_t *kv = NULL;
 
 	/* basic value check */
 	if(NULL == b) { errno = EINVAL; return -1; }
+	if(_bundle_check_writable(b)) return -1;
 	if(NULL == key) { errno = EKEYREJECTED; return -1; }
 	if(0 == strlen(key)) { errno = EKEYREJECTED; return -1; }
 
-	kv = b->kv_head;
-	while (kv != NULL) {
-		if(0 == strcmp(key, kv->key)) break;
-		prev_kv = kv;
-		kv = kv->next;
-	} 
+	kv = _bundle_find_kv(b, key);
 	if (NULL == kv) { errno = ENOKEY; return -1; }
-	else {
-		if(NULL != prev_kv) {
-			prev_kv->next = kv->next;
-		}
-		if(kv == b->kv_head) b->kv_head = kv->next;
-		kv->method->free(kv, 1);
+
+	_bundle_unlink_kv(b, kv);
+	_bundle_pool_put(b, kv);
+	return 0;
+
+}
+
+const bundle_key_t *
+bundle_key_get(const char *key)
+{
+	const char *ikey;
+
+	if(NULL == key || 0 == strlen(key)) { errno = EKEYREJECTED; return NULL; }
+
+	ikey = keyval_key_intern(key);
+	if(NULL == ikey) return NULL;
+
+	return keyval_key_get_entry(ikey);
+}
+
+void
+bundle_key_put(const bundle_key_t *key)
+{
+	if(key) keyval_key_unref(key->str);
+}
+
+int
+bundle_add_str_k(bundle *b, const bundle_key_t *key, const char *str)
+{
+	keyval_t *pooled_kv, *new_kv;
+
+	if(!str) { errno = EINVAL; return -1; }
+	if(_bundle_check_writable(b)) return -1;
+	if(_bundle_find_kv_k(b, key)) {	/* Key already exists */
+		errno = EPERM;
+		return -1;
+	}
+	if(ENOKEY != errno) return -1;
+	errno = 0;
+
+	pooled_kv = _bundle_pool_get(b, 0);
+	new_kv = keyval_new_interned(pooled_kv, key->str, BUNDLE_TYPE_STR, str, strlen(str)+1);
+	if(!new_kv) {
+		_bundle_pool_unget(b, pooled_kv, 0);
+		return -1;
 	}
+
+	_bundle_append_kv(b, new_kv);
 	return 0;
+}
+
+int
+bundle_get_str_k(bundle *b, const bundle_key_t *key, char **str)
+{
+	keyval_t *kv = _bundle_find_kv_k(b, key);
+	if(!kv) return -1;
+	return _bundle_get_kv_val(kv, BUNDLE_TYPE_STR, (void **)str, NULL, NULL, NULL);
+}
+
+int
+bundle_del_k(bundle *b, const bundle_key_t *key)
+{
+	if(_bundle_check_writable(b)) return -1;
+
+	keyval_t *kv = _bundle_find_kv_k(b, key);
+	if(!kv) return -1;
 
+	_bundle_unlink_kv(b, kv);
+	_bundle_pool_put(b, kv);
+	return 0;
 }
 
 const char *
@@ -266,23 +912,86 @@ bundle_get_val(bundle *b, const char *key)
 
 }
 
-/**
- * @brief used by bundle_get_count() API, to count number of items in a bundle
- */
-static void
-_bundle_get_count_iter(const char *k, const int type, const bundle_keyval_t *kv, void *user_data)
+int
+bundle_add_many(bundle *b, const char **keys, const char **vals, const int n)
+{
+	keyval_t *last_kv, *kv, *new_kv;
+	int i, err;
+
+	if(NULL == b || NULL == keys || NULL == vals || 0 > n) {
+		errno = EINVAL;
+		return -1;
+	}
+	if(_bundle_check_writable(b)) return -1;
+
+	/* Size index once for all new kvs */
+	_bundle_index_reserve(b, b->count + n);
+	last_kv = b->kv_tail;
+
+	for(i = 0; i < n; i++) {
+		if(NULL == keys[i] || 0 == strlen(keys[i])) { errno = EKEYREJECTED; goto ROLLBACK; }
+		if(NULL == vals[i]) { errno = EINVAL; goto ROLLBACK; }
+
+		/* Keys added in this call are already in index, too */
+		if(_bundle_index_find(b, keys[i], keyval_hash_key(keys[i]))) {
+			errno = EPERM;
+			goto ROLLBACK;
+		}
+
+		kv = _bundle_pool_get(b, 0);
+		new_kv = keyval_new(kv, keys[i], BUNDLE_TYPE_STR, vals[i], strlen(vals[i]) + 1);
+		if(NULL == new_kv) {
+			_bundle_pool_unget(b, kv, 0);
+			goto ROLLBACK;
+		}
+		_bundle_append_kv(b, new_kv);
+	}
+
+	errno = 0;
+	return 0;
+
+ROLLBACK:
+	/* Remove kvs added in this call */
+	err = errno;
+	while(b->kv_tail != last_kv) {
+		kv = b->kv_tail;
+		_bundle_unlink_kv(b, kv);
+		_bundle_pool_put(b, kv);
+	}
+	errno = err;
+	return -1;
+}
+
+int
+bundle_get_many(bundle *b, const char **keys, const char **vals, const int n)
 {
-	int *count = (int *)user_data;
-	*count += 1;
+	keyval_t *kv;
+	int i, found = 0;
+
+	if(NULL == b || NULL == keys || NULL == vals || 0 > n) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	for(i = 0; i < n; i++) {
+		vals[i] = NULL;
+		if(NULL == keys[i]) continue;
+
+		kv = _bundle_index_find(b, keys[i], keyval_hash_key(keys[i]));
+		if(kv && BUNDLE_TYPE_STR == kv->type) {
+			vals[i] = kv->val;
+			found++;
+		}
+	}
+
+	return found;
 }
 
 int
 bundle_get_count (bundle *b)
 {
-	int count = 0;
-	if (NULL == b) return count;
-	bundle_foreach(b, _bundle_get_count_iter, &count);
-	return count;
+	if (NULL == b) return 0;
+	return b->count;
 }
 
 void
@@ -313,6 +1022,87 @@ bundle_foreach(bundle *b, bundle_iterator_t iter, void *user_data)
 	}
 }
 
+int
+bundle_foreach_prefix(bundle *b, const char *prefix, bundle_iterator_t iter, void *user_data)
+{
+	keyval_t **sorted;
+	int first, last, i;
+
+	if(NULL == iter) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	sorted = _bundle_prefix_range(b, prefix, &first, &last);
+	if(NULL == sorted) return -1;
+
+	for(i = first; i < last; i++) {
+		iter(sorted[i]->key, sorted[i]->type, sorted[i], user_data);
+	}
+	return last - first;
+}
+
+int
+bundle_count_prefix(bundle *b, const char *prefix)
+{
+	int first, last;
+
+	if(NULL == _bundle_prefix_range(b, prefix, &first, &last)) return -1;
+	return last - first;
+}
+
+int
+bundle_del_prefix(bundle *b, const char *prefix)
+{
+	keyval_t **sorted;
+	int first, last, i;
+
+	if(_bundle_check_writable(b)) return -1;
+
+	sorted = _bundle_prefix_range(b, prefix, &first, &last);
+	if(NULL == sorted) return -1;
+
+	for(i = first; i < last; i++) {
+		_bundle_unlink_kv(b, sorted[i]);
+		_bundle_pool_put(b, sorted[i]);
+	}
+
+	/* Remaining kvs are still sorted */
+	memmove(sorted + first, sorted + last, (b->count - first) * sizeof(keyval_t *));
+	b->sorted_valid = 1;
+
+	return last - first;
+}
+
+int
+bundle_iter_init(bundle *b, bundle_iter_t *iter)
+{
+	if(NULL == b || NULL == iter) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	iter->_b = b;
+	iter->_next = b->kv_head;
+	return 0;
+}
+
+int
+bundle_iter_next(bundle_iter_t *iter, const char **key, int *type, bundle_keyval_t **kv)
+{
+	keyval_t *cur;
+
+	if(NULL == iter || NULL == iter->_next) return 0;
+
+	cur = iter->_next;
+	iter->_next = cur->next;	/* Advance first, so that cur can be deleted */
+
+	if(key) *key = cur->key;
+	if(type) *type = cur->type;
+	if(kv) *kv = cur;
+	return 1;
+}
+
 /* keyval functions */
 int 
 bundle_keyval_get_type(bundle_keyval_t *kv)
@@ -323,7 +1113,14 @@ bundle_keyval_get_type(bundle_keyval_t *kv)
 int 
 bundle_keyval_type_is_array(bundle_keyval_t *kv)
 {
-	return keyval_type_is_array(kv->type);
+	/* Primitive arrays are one block, which is read by bundle_keyval_get_basic_val() */
+	return keyval_type_is_array(kv->type) ? 1 : 0;
+}
+
+int
+bundle_keyval_type_is_primitive_array(bundle_keyval_t *kv)
+{
+	return ((kv->type & BUNDLE_TYPE_ARRAY) && (kv->type & BUNDLE_TYPE_PRIMITIVE)) ? 1 : 0;
 }
 
 int 
@@ -349,32 +1146,53 @@ _iter_do_bundle_dup(const char *key, const void *val, const int type, const size
 
 }
 */
+/**
+ * Copy kv_from into b_to
+ */
+static int
+_bundle_copy_kv(bundle *b_to, keyval_t *kv_from)
+{
+	keyval_t *kv_to = NULL;
+	int i;
+
+	if(keyval_type_is_array(kv_from->type)) {
+		keyval_array_t *kva_from = (keyval_array_t *)kv_from;
+		kv_to = (keyval_t *) keyval_array_new(NULL, kv_from->key, kv_from->type, NULL, kva_from->len);
+		if(!kv_to) return -1;
+		for(i=0; i < kva_from->len; i++) {
+			if(((keyval_array_t *)kv_from)->array_val[i]) {
+				keyval_array_set_element((keyval_array_t*)kv_to, i, ((keyval_array_t *)kv_from)->array_val[i], ((keyval_array_t *)kv_from)->array_element_size[i]);
+			}
+		}
+		_bundle_append_kv(b_to, kv_to);
+	}
+	else {
+		if(_bundle_add_kv(b_to, kv_from->key, kv_from->val, kv_from->size, kv_from->type, 0)) return -1;
+	}
+
+	return 0;
+}
+
 bundle *
 bundle_dup(bundle *b_from)
+{
+	return bundle_project(b_from, NULL, NULL);
+}
+
+bundle *
+bundle_project(bundle *b_from, bundle_filter_t filter, void *user_data)
 {
 	bundle *b_to = NULL;
-	int i;
 
 	if(NULL == b_from) { errno = EINVAL; return NULL; }
 	b_to = bundle_create();
 	if(NULL == b_to) return NULL;
+	if(NULL == filter) _bundle_index_reserve(b_to, b_from->count);
 
 	keyval_t *kv_from = b_from->kv_head;
-	keyval_t *kv_to = NULL;
 	while(kv_from != NULL) {
-		if(keyval_type_is_array(kv_from->type)) {
-			keyval_array_t *kva_from = (keyval_array_t *)kv_from;
-			kv_to = (keyval_t *) keyval_array_new(NULL, kv_from->key, kv_from->type, NULL, kva_from->len);
-			if(!kv_to) goto ERR_CLEANUP;
-			for(i=0; i < kva_from->len; i++) {
-				if(((keyval_array_t *)kv_from)->array_val[i]) {
-					keyval_array_set_element((keyval_array_t*)kv_to, i, ((keyval_array_t *)kv_from)->array_val[i], ((keyval_array_t *)kv_from)->array_element_size[i]);
-				}
-			}
-			_bundle_append_kv(b_to, kv_to);
-		}
-		else {
-			if(_bundle_add_kv(b_to, kv_from->key, kv_from->val, kv_from->size, kv_from->type, 0)) goto ERR_CLEANUP;
+		if(NULL == filter || filter(kv_from->key, kv_from->type, kv_from, user_data)) {
+			if(_bundle_copy_kv(b_to, kv_from)) goto ERR_CLEANUP;
 		}
 
 		kv_from = kv_from->next;
@@ -386,64 +1204,1141 @@ ERR_CLEANUP:
 	return NULL;
 }
 
-
-int
-bundle_encode(bundle *b, bundle_raw **r, int *len)
+bundle *
+bundle_project_keys(bundle *b_from, const char **keys, const int n_keys)
 {
-	keyval_t *kv;
-	unsigned char *m;
-	unsigned char *p_m;
-	unsigned char *byte;
-	size_t byte_len;
-	gchar *chksum_val;
-
-	if(NULL == b) {
-		errno = EINVAL;
-		return -1;
-	}
+	bundle *b_to = NULL;
+	keyval_t *kv_from;
+	int i;
 
-	/* calculate memory size */
-	size_t msize = 0;	// Sum of required size
+	if(NULL == b_from || (NULL == keys && n_keys) || 0 > n_keys) { errno = EINVAL; return NULL; }
+	b_to = bundle_create();
+	if(NULL == b_to) return NULL;
+	_bundle_index_reserve(b_to, n_keys);
 
-	kv = b->kv_head;
-	while(kv != NULL) {
-		msize += kv->method->get_encoded_size(kv);
-		kv = kv->next;
+	for(i = 0; i < n_keys; i++) {
+		if(NULL == keys[i]) continue;
+		kv_from = _bundle_index_find(b_from, keys[i], keyval_hash_key(keys[i]));
+		if(NULL == kv_from) continue;	/* Missing keys are skipped */
+		if(_bundle_copy_kv(b_to, kv_from)) goto ERR_CLEANUP;
 	}
-	m = calloc(msize+CHECKSUM_LENGTH, sizeof(unsigned char));
-	if(unlikely(NULL == m ))  { errno = ENOMEM; return -1; }
+	return b_to;
 
-	p_m = m+CHECKSUM_LENGTH;	/* temporary pointer */
+ERR_CLEANUP:
+	bundle_free(b_to);
+	return NULL;
+}
 
-	kv = b->kv_head;
-	while(kv != NULL) {
-		byte = NULL;
-		byte_len = 0;
 
-		kv->method->encode(kv, &byte, &byte_len);
-		memcpy(p_m, byte, byte_len);
+/**
+ * Prefix checksum to encoded keyvals, and make bundle_raw with base64
+ * m must have CHECKSUM_LENGTH bytes reserved in front of msize bytes of data.
+ */
+static int
+_bundle_raw_seal(unsigned char *m, size_t msize, bundle_raw **r, int *len)
+{
+	gchar *chksum_val;
+
+	/*compute checksum from the data*/
+	chksum_val = g_compute_checksum_for_string(G_CHECKSUM_MD5,(gchar *)m+CHECKSUM_LENGTH,msize);
+	/*prefix checksum to the data */
+	memcpy(m,chksum_val,CHECKSUM_LENGTH);
+	if ( NULL != r ) {
+		/*base64 encode for whole string checksum and data*/
+		*r =(unsigned char*)g_base64_encode(m,msize+CHECKSUM_LENGTH);
+		if ( NULL != len ) *len = strlen((char*)*r);
+	}
+	g_free(chksum_val);/*free checksum string */
+
+	return 0;
+}
+
+/**
+ * Verify checksum in front of encoded keyvals
+ */
+static int
+_bundle_verify_checksum(const unsigned char *d, size_t d_len)
+{
+	gchar* compute_cksum;
+
+	/* compute checksum for the data */
+	compute_cksum = g_compute_checksum_for_string(G_CHECKSUM_MD5,(gchar *)d+CHECKSUM_LENGTH,d_len-CHECKSUM_LENGTH);
+	/*compare checksum values- extracted from the received string and computed from the data */
+	if(NULL == compute_cksum || 0 != strncmp((char *)d,compute_cksum,CHECKSUM_LENGTH))
+	{
+		g_free(compute_cksum);
+		errno = EBADMSG;
+		return -1;
+	}
+	g_free(compute_cksum);
+	return 0;
+}
+
+/* Header of an encoded kv: total size, type, and key size */
+#define KV_HEADER_SIZE (sizeof(size_t) + sizeof(int) + sizeof(size_t))
+
+/**
+ * Check sizes in an encoded kv, which has avail bytes in its buffer
+ * A checked kv can be decoded without reading out of the buffer, and its key is null-terminated.
+ * Sizes are copied out, because the buffer may not be aligned.
+ * @return	Total size of the encoded kv, or 0 if it is broken.
+ */
+static size_t
+_bundle_check_encoded_kv(const unsigned char *p, size_t avail)
+{
+	size_t total, key_size, size, rest;
+	unsigned int len, i;
+	int type;
+
+	if(avail < KV_HEADER_SIZE) return 0;
+	memcpy(&total, p, sizeof(size_t));
+	memcpy(&type, p + sizeof(size_t), sizeof(int));
+	memcpy(&key_size, p + sizeof(size_t) + sizeof(int), sizeof(size_t));
+	if(total < KV_HEADER_SIZE || total > avail) return 0;
+
+	rest = total - KV_HEADER_SIZE;
+	if(0 == key_size || key_size > rest || '\0' != p[KV_HEADER_SIZE + key_size - 1]) return 0;
+	p += KV_HEADER_SIZE + key_size;
+	rest -= key_size;
+
+	if(keyval_type_is_array(type)) {
+		if(rest < sizeof(unsigned int)) return 0;
+		memcpy(&len, p, sizeof(unsigned int));
+		p += sizeof(unsigned int);
+		rest -= sizeof(unsigned int);
+
+		if(len > rest / sizeof(size_t)) return 0;
+		rest -= len * sizeof(size_t);
+		for(i = 0; i < len; i++) {
+			memcpy(&size, p + i * sizeof(size_t), sizeof(size_t));
+			if(size > rest) return 0;
+			rest -= size;
+		}
+	}
+	else {
+		if(rest < sizeof(size_t)) return 0;
+		memcpy(&size, p, sizeof(size_t));
+		if(size > rest - sizeof(size_t)) return 0;
+	}
+
+	return total;
+}
+
+/**
+ * Check sizes of all kvs in a stream, before any of them is decoded
+ * Checksum does not protect from a broken sender, because anyone can compute it.
+ */
+static int
+_bundle_check_stream(const unsigned char *d_r, size_t d_len)
+{
+	const unsigned char *p = d_r;
+	const unsigned char *end = d_r + d_len;
+	size_t total;
+
+	while(p < end) {
+		total = _bundle_check_encoded_kv(p, end - p);
+		if(0 == total) {
+			errno = EBADMSG;
+			return -1;
+		}
+		p += total;
+	}
+	return 0;
+}
+
+/**
+ * Decode base64 of bundle_raw, and verify its checksum and sizes of its kvs
+ * On success, *d_str must be freed, and *d_r points keyvals in it.
+ */
+static int
+_bundle_raw_open(const bundle_raw *r, unsigned char **d_str, unsigned char **d_r, size_t *d_len)
+{
+	gsize d_len_raw = 0;
+
+	/* base 64 decode of input string*/
+	*d_str = g_base64_decode((char*)r, &d_len_raw);
+	if(NULL == *d_str || d_len_raw < CHECKSUM_LENGTH) {
+		free(*d_str);
+		errno = EINVAL;
+		return -1;
+	}
+	if(_bundle_verify_checksum(*d_str, d_len_raw)
+			|| _bundle_check_stream(*d_str + CHECKSUM_LENGTH, d_len_raw - CHECKSUM_LENGTH)) {
+		free(*d_str);
+		return -1;
+	}
+
+	*d_r = *d_str+CHECKSUM_LENGTH;
+	*d_len = d_len_raw-CHECKSUM_LENGTH;
+	return 0;
+}
+
+/**
+ * Decode a keyval from byte, according to its type
+ */
+static size_t
+_bundle_decode_kv(unsigned char *byte, keyval_t **kv)
+{
+	// Find type, and use decode function according to type
+	int type = keyval_get_type_from_encoded_byte(byte);
+
+	if(keyval_type_is_array(type)) {
+		return keyval_array_decode(byte, (keyval_array_t **) kv);
+	}
+	if(BUNDLE_TYPE_BUNDLE == type) {
+		return keyval_bundle_decode(byte, (keyval_bundle_t **) kv);
+	}
+	return keyval_decode(byte, kv);
+}
+
+/**
+ * Encode keyvals of bundle into a byte stream
+ * @param[in]	headroom	Bytes to be reserved in front of the stream
+ * @param[in]	filter	Only kvs selected by filter are encoded. If NULL, all kvs are encoded.
+ *				It is called once for each kv.
+ * @param[in]	user_data	Data for filter
+ * @param[in]	flags	bundle_encode_flag values
+ * @param[out]	msize	Size of the stream, without headroom
+ * @return	Allocated memory which has headroom and the stream. It must be freed.
+ */
+static unsigned char *
+_bundle_encode_stream(bundle *b, size_t headroom, bundle_filter_t filter, void *user_data, int flags, size_t *msize)
+{
+	keyval_t *kv;
+	keyval_t **sorted = NULL;
+	keyval_t **kvs = NULL;	/* kvs to be encoded, in order. If NULL, all kvs in list order. */
+	keyval_t **selected = NULL;
+	int n_kvs = 0;
+	int i;
+	unsigned char *m;
+	unsigned char *p_m;
+	unsigned char *byte;
+	size_t byte_len;
+
+	/* Canonical order is key order */
+	if(flags & BUNDLE_ENCODE_CANONICAL) {
+		sorted = _bundle_get_sorted(b);
+		if(NULL == sorted) return NULL;
+		kvs = sorted;
+		n_kvs = b->count;
+	}
+
+	/* Select kvs first. filter may not return the same result when it is called again. */
+	if(filter) {
+		selected = calloc(b->count + 1, sizeof(keyval_t *));
+		if(NULL == selected) { errno = ENOMEM; return NULL; }
+
+		n_kvs = 0;
+		for(i = 0, kv = sorted ? (b->count ? sorted[0] : NULL) : b->kv_head;
+				kv != NULL;
+				kv = sorted ? (++i < b->count ? sorted[i] : NULL) : kv->next) {
+			if(filter(kv->key, kv->type, kv, user_data)) selected[n_kvs++] = kv;
+		}
+		kvs = selected;
+	}
+
+	/* calculate memory size */
+	*msize = 0;	// Sum of required size
+
+	for(i = 0, kv = kvs ? (n_kvs ? kvs[0] : NULL) : b->kv_head;
+			kv != NULL;
+			kv = kvs ? (++i < n_kvs ? kvs[i] : NULL) : kv->next) {
+		*msize += kv->method->get_encoded_size(kv);
+	}
+	m = calloc(*msize+headroom, sizeof(unsigned char));
+	if(unlikely(NULL == m ))  { free(selected); errno = ENOMEM; return NULL; }
+
+	p_m = m+headroom;	/* temporary pointer */
+
+	for(i = 0, kv = kvs ? (n_kvs ? kvs[0] : NULL) : b->kv_head;
+			kv != NULL;
+			kv = kvs ? (++i < n_kvs ? kvs[i] : NULL) : kv->next) {
+		if(kv->encoded) {	/* Not changed since last encoding */
+			memcpy(p_m, kv->encoded, kv->encoded_size);
+			p_m += kv->encoded_size;
+			continue;
+		}
+
+		byte = NULL;
+		byte_len = 0;
+
+		kv->method->encode(kv, &byte, &byte_len);
+		memcpy(p_m, byte, byte_len);
+
+		p_m += byte_len;
+
+		if(b->keep_encoded && byte) kv->encoded = byte;	/* byte_len == kv->encoded_size */
+		else free(byte);
+	}
+
+	free(selected);
+	return m;
+}
+
+/**
+ * Decode a byte stream of keyvals, and append them into bundle
+ * Stream must be checked by _bundle_check_stream().
+ * Free kvs in pool of b are reused.
+ */
+static int
+_bundle_decode_stream(bundle *b, unsigned char *d_r, size_t d_len)
+{
+	unsigned char *p_r = d_r;
+	size_t bytes_read;
+	keyval_t *kv;
+	int type;
+
+	if(NULL == d_r) return 0;
+
+	while(p_r < d_r + d_len) {
+		type = keyval_get_type_from_encoded_byte(p_r);
+		kv = BUNDLE_TYPE_BUNDLE == type ? NULL : _bundle_pool_get(b, keyval_type_is_array(type));
+
+		bytes_read = _bundle_decode_kv(p_r, &kv);
+
+		if(0 == bytes_read) {	/* errno is set by decoder */
+			_bundle_pool_unget(b, kv, keyval_type_is_array(type));	/* Given kv is left cleared */
+			return -1;
+		}
+		_bundle_append_kv(b, kv);
+		p_r += bytes_read;
+	}
+	return 0;
+}
+
+int
+bundle_encode(bundle *b, bundle_raw **r, int *len)
+{
+	if(NULL == b) {
+		errno = EINVAL;
+		return -1;
+	}
+	if(NULL == r) return 0;	/* Nothing to return, same to encoding without r */
+
+	/* Copy shared encoding, if b is not changed since then */
+	if(b->enc && b->enc_gen == b->gen) {
+		*r = malloc(b->enc_len + 1);
+		if(NULL == *r) {
+			errno = ENOMEM;
+			return -1;
+		}
+		memcpy(*r, b->enc, b->enc_len + 1);
+		if(len) *len = b->enc_len;
+		return 0;
+	}
+
+	return bundle_encode_filtered(b, NULL, NULL, r, len);
+}
+
+int
+bundle_encode_with_flags(bundle *b, int flags, bundle_raw **r, int *len)
+{
+	unsigned char *m;
+	size_t msize;
+
+	if(NULL == b || (flags & ~BUNDLE_ENCODE_CANONICAL)) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	m = _bundle_encode_stream(b, CHECKSUM_LENGTH, NULL, NULL, flags, &msize);
+	if(unlikely(NULL == m)) return -1;
+
+	_bundle_raw_seal(m, msize, r, len);
+	free(m);
+
+	return 0;
+}
+
+/* Max number of values passed by fds in a frame. Same to SCM_MAX_FD of kernel. */
+#define FRAME_MAX_FDS 253
+
+/**
+ * Check if value of kv is sent by an fd, not in the frame
+ */
+static inline int
+_bundle_kv_pass_fd(keyval_t *kv, size_t threshold)
+{
+	return threshold && (BUNDLE_TYPE_STR == kv->type || BUNDLE_TYPE_BYTE == kv->type) && kv->size >= threshold;
+}
+
+/**
+ * Encode bundle into iovecs of binary format.
+ * First headroom iovecs are left empty for the caller.
+ * If threshold is not 0, first FRAME_MAX_FDS kvs to be passed by fds are skipped.
+ */
+static int
+_bundle_encode_iov(bundle *b, int headroom, size_t threshold, struct iovec **iov, int *iovcnt)
+{
+	keyval_t *kv;
+	keyval_array_t *kva;
+	struct iovec *v;
+	unsigned char *h;
+	size_t hdr_size, total, key_size;
+	int n_iov, n, i, n_skip;
+	GChecksum *cs;
+
+	/* Count segments and header bytes */
+	n_iov = headroom + 1;
+	hdr_size = CHECKSUM_LENGTH;
+	n_skip = 0;
+	for(kv = b->kv_head; kv != NULL; kv = kv->next) {
+		if(n_skip < FRAME_MAX_FDS && _bundle_kv_pass_fd(kv, threshold)) {
+			n_skip++;
+		}
+		else if(kv->encoded) {
+			n_iov += 1;
+		}
+		else if(keyval_type_is_array(kv->type)) {
+			n_iov += 4 + ((keyval_array_t *)kv)->len;
+			hdr_size += KV_HEADER_SIZE + sizeof(unsigned int);
+		}
+		else {
+			n_iov += 4;
+			hdr_size += KV_HEADER_SIZE + sizeof(size_t);
+		}
+	}
+
+	/* iovecs and headers in one block */
+	v = malloc(n_iov * sizeof(struct iovec) + hdr_size);
+	if(NULL == v) {
+		errno = ENOMEM;
+		return -1;
+	}
+	h = (unsigned char *)(v + n_iov);
+
+#define ADD_IOV(base, len) do { v[n].iov_base = (void *)(base); v[n].iov_len = (len); n++; } while(0)
+
+	memset(v, 0, headroom * sizeof(struct iovec));
+	n = headroom;
+	ADD_IOV(h, CHECKSUM_LENGTH);	/* Filled at last */
+	h += CHECKSUM_LENGTH;
+
+	n_skip = 0;
+	for(kv = b->kv_head; kv != NULL; kv = kv->next) {
+		if(n_skip < FRAME_MAX_FDS && _bundle_kv_pass_fd(kv, threshold)) {
+			n_skip++;
+			continue;
+		}
+
+		total = kv->method->get_encoded_size(kv);
+
+		if(kv->encoded) {	/* Kept by incremental encoding */
+			ADD_IOV(kv->encoded, total);
+			continue;
+		}
+
+		key_size = keyval_key_get_entry(kv->key)->len + 1;
+		memcpy(h, &total, sizeof(size_t));
+		memcpy(h + sizeof(size_t), &kv->type, sizeof(int));
+		memcpy(h + sizeof(size_t) + sizeof(int), &key_size, sizeof(size_t));
+		ADD_IOV(h, KV_HEADER_SIZE);
+		h += KV_HEADER_SIZE;
+
+		ADD_IOV(kv->key, key_size);
+
+		if(keyval_type_is_array(kv->type)) {
+			kva = (keyval_array_t *)kv;
+			memcpy(h, &kva->len, sizeof(unsigned int));
+			ADD_IOV(h, sizeof(unsigned int));
+			h += sizeof(unsigned int);
+
+			if(kva->len) ADD_IOV(kva->array_element_size, kva->len * sizeof(size_t));
+			for(i = 0; i < kva->len; i++) {
+				if(kva->array_element_size[i]) ADD_IOV(kva->array_val[i], kva->array_element_size[i]);
+			}
+		}
+		else {
+			memcpy(h, &kv->size, sizeof(size_t));
+			ADD_IOV(h, sizeof(size_t));
+			h += sizeof(size_t);
+
+			if(kv->size) ADD_IOV(kv->val, kv->size);
+		}
+	}
+
+#undef ADD_IOV
+
+	/* Checksum over segments, without copying them */
+	cs = g_checksum_new(G_CHECKSUM_MD5);
+	if(NULL == cs) {
+		free(v);
+		errno = ENOMEM;
+		return -1;
+	}
+	for(i = headroom + 1; i < n; i++) g_checksum_update(cs, v[i].iov_base, v[i].iov_len);
+	memcpy(v[headroom].iov_base, g_checksum_get_string(cs), CHECKSUM_LENGTH);
+	g_checksum_free(cs);
+
+	*iov = v;
+	*iovcnt = n;
+	return 0;
+}
+
+int
+bundle_encode_iov(bundle *b, struct iovec **iov, int *iovcnt)
+{
+	if(NULL == b || NULL == iov || NULL == iovcnt) {
+		errno = EINVAL;
+		return -1;
+	}
+	return _bundle_encode_iov(b, 0, 0, iov, iovcnt);
+}
+
+int
+bundle_encode_binary(bundle *b, unsigned char **data, size_t *len)
+{
+	unsigned char *m;
+	size_t msize;
+
+	if(NULL == b || NULL == data || NULL == len) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	m = _bundle_encode_stream(b, CHECKSUM_LENGTH, NULL, NULL, 0, &msize);
+	if(unlikely(NULL == m)) return -1;
+
+	_bundle_raw_seal(m, msize, NULL, NULL);	/* Checksum only, without base64 */
+
+	*data = m;
+	*len = msize + CHECKSUM_LENGTH;
+	return 0;
+}
+
+bundle *
+bundle_decode_binary(const unsigned char *data, const size_t len)
+{
+	bundle *b;
+
+	if(NULL == data || CHECKSUM_LENGTH > len) {
+		errno = EINVAL;
+		return NULL;
+	}
+	if(_bundle_verify_checksum(data, len)) return NULL;
+	if(_bundle_check_stream(data + CHECKSUM_LENGTH, len - CHECKSUM_LENGTH)) return NULL;
+
+	b = bundle_create();
+	if(NULL == b) return NULL;
+
+	if(_bundle_decode_stream(b, (unsigned char *)data + CHECKSUM_LENGTH, len - CHECKSUM_LENGTH)) {
+		bundle_free(b);
+		return NULL;
+	}
+	return b;
+}
+
+/**
+ * Find an encoded kv of key in binary format data, by walking total sizes of kvs
+ * @return	Pointer to the encoded kv, or NULL with errno set.
+ */
+static const unsigned char *
+_bundle_binary_find(const unsigned char *data, size_t len, const char *key)
+{
+	const unsigned char *p = data + CHECKSUM_LENGTH;
+	const unsigned char *end = data + len;
+	size_t total;
+
+	while(p < end) {
+		total = _bundle_check_encoded_kv(p, end - p);
+		if(0 == total) {
+			errno = EBADMSG;
+			return NULL;
+		}
+		if(0 == strcmp(key, (const char *)p + KV_HEADER_SIZE)) return p;
+		p += total;
+	}
+
+	errno = ENOKEY;
+	return NULL;
+}
+
+int
+bundle_raw_get_str(const unsigned char *data, const size_t len, const char *key, const char **str, size_t *size)
+{
+	const unsigned char *p;
+	size_t total, key_size, val_size;
+	int type;
+
+	if(NULL == data || CHECKSUM_LENGTH > len || NULL == key || NULL == str) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	p = _bundle_binary_find(data, len, key);
+	if(NULL == p) return -1;
+
+	memcpy(&total, p, sizeof(size_t));
+	memcpy(&type, p + sizeof(size_t), sizeof(int));
+	memcpy(&key_size, p + sizeof(size_t) + sizeof(int), sizeof(size_t));
+	if(BUNDLE_TYPE_STR != type) {
+		errno = ENOTSUP;
+		return -1;
+	}
+
+	p += KV_HEADER_SIZE + key_size;
+	total -= KV_HEADER_SIZE + key_size;
+	if(total < sizeof(size_t)) goto bad_message;
+	memcpy(&val_size, p, sizeof(size_t));
+	p += sizeof(size_t);
+	if(0 == val_size || val_size > total - sizeof(size_t) || '\0' != p[val_size - 1]) goto bad_message;
+
+	*str = (const char *)p;
+	if(size) *size = val_size - 1;
+	return 0;
+
+bad_message:
+	errno = EBADMSG;
+	return -1;
+}
+
+int
+bundle_raw_append(unsigned char **data, size_t *len, const char *key, const char *str, int flags)
+{
+	unsigned char *d, *p;
+	size_t key_size, val_size, total;
+	int type = BUNDLE_TYPE_STR;
+	GChecksum *cs, *old;
+	int valid;
+
+	if(NULL == data || NULL == *data || NULL == len || CHECKSUM_LENGTH > *len || NULL == str) {
+		errno = EINVAL;
+		return -1;
+	}
+	if(NULL == key || 0 == strlen(key)) {
+		errno = EKEYREJECTED;
+		return -1;
+	}
+	if(flags & BUNDLE_RAW_APPEND_CHECK_DUP) {
+		if(_bundle_binary_find(*data, *len, key)) {	/* Key already exists */
+			errno = EPERM;
+			return -1;
+		}
+		if(ENOKEY != errno) return -1;
+	}
+
+	key_size = strlen(key) + 1;
+	val_size = strlen(str) + 1;
+	total = KV_HEADER_SIZE + key_size + sizeof(size_t) + val_size;
+
+	/* Existing data is verified in the same pass, by a copy of the running checksum */
+	cs = g_checksum_new(G_CHECKSUM_MD5);
+	if(NULL == cs) {
+		errno = ENOMEM;
+		return -1;
+	}
+	g_checksum_update(cs, *data + CHECKSUM_LENGTH, *len - CHECKSUM_LENGTH);
+	old = g_checksum_copy(cs);
+	if(NULL == old) {
+		g_checksum_free(cs);
+		errno = ENOMEM;
+		return -1;
+	}
+	valid = (0 == strncmp((char *)*data, g_checksum_get_string(old), CHECKSUM_LENGTH));
+	g_checksum_free(old);
+	if(!valid) {
+		g_checksum_free(cs);
+		errno = EBADMSG;
+		return -1;
+	}
+
+	d = realloc(*data, *len + total);
+	if(NULL == d) {
+		g_checksum_free(cs);
+		errno = ENOMEM;
+		return -1;
+	}
+	*data = d;
+
+	/* Same layout to keyval_encode() */
+	p = d + *len;
+	memcpy(p, &total, sizeof(size_t));
+	memcpy(p + sizeof(size_t), &type, sizeof(int));
+	memcpy(p + sizeof(size_t) + sizeof(int), &key_size, sizeof(size_t));
+	p += KV_HEADER_SIZE;
+	memcpy(p, key, key_size);
+	p += key_size;
+	memcpy(p, &val_size, sizeof(size_t));
+	p += sizeof(size_t);
+	memcpy(p, str, val_size);
+
+	g_checksum_update(cs, d + *len, total);
+	*len += total;
+	memcpy(d, g_checksum_get_string(cs), CHECKSUM_LENGTH);
+	g_checksum_free(cs);
+
+	return 0;
+}
+
+/*
+ * Frame of bundle_send():
+ *   frame_header_t | fd table | binary format of the other kvs
+ * fd table has an entry for each value passed by an fd, in the order of fds:
+ *   type int | keysize size_t | size size_t | key
+ */
+#define FRAME_MAGIC 0x4c444e42	/* "BNDL" */
+#define FRAME_FD_ENTRY_SIZE (sizeof(int) + sizeof(size_t) + sizeof(size_t))
+
+typedef struct {
+	uint32_t magic;
+	uint32_t n_fds;
+	uint64_t fd_table_len;
+	uint64_t data_len;
+} frame_header_t;
+
+typedef union {
+	struct cmsghdr h;
+	char buf[CMSG_SPACE(sizeof(int) * FRAME_MAX_FDS)];
+} frame_cmsg_t;
+
+static void
+_bundle_close_fds(int *fds, int n_fds)
+{
+	int i;
+	for(i = 0; i < n_fds; i++) close(fds[i]);
+}
+
+/**
+ * Copy a value into a sealed memfd
+ */
+static int
+_bundle_memfd_new(const void *val, size_t size)
+{
+	int fd;
+	ssize_t n;
+	size_t done = 0;
+
+	fd = memfd_create("bundle", MFD_CLOEXEC | MFD_ALLOW_SEALING);
+	if(fd < 0) return -1;
+
+	while(done < size) {
+		n = write(fd, (const char *)val + done, size - done);
+		if(n < 0) {
+			if(EINTR == errno) continue;
+			goto error;
+		}
+		done += n;
+	}
+
+	/* Receiver can trust the size, and the value is not changed after sent */
+	if(fcntl(fd, F_ADD_SEALS, F_SEAL_SHRINK | F_SEAL_GROW | F_SEAL_WRITE | F_SEAL_SEAL)) goto error;
+	return fd;
+
+error:
+	n = errno;
+	close(fd);
+	errno = n;
+	return -1;
+}
+
+/**
+ * Send all iovecs, in several sendmsg() calls if needed. fds go with the first byte.
+ * iov is modified.
+ */
+static int
+_bundle_sendmsg_all(int sock, struct iovec *iov, int iovcnt, const int *fds, int n_fds)
+{
+	struct msghdr msg;
+	struct cmsghdr *cmsg;
+	frame_cmsg_t cbuf;
+	ssize_t n;
+
+	while(iovcnt > 0) {
+		memset(&msg, 0, sizeof(msg));
+		msg.msg_iov = iov;
+		msg.msg_iovlen = iovcnt < IOV_MAX ? iovcnt : IOV_MAX;
+		if(n_fds) {
+			msg.msg_control = cbuf.buf;
+			msg.msg_controllen = CMSG_SPACE(sizeof(int) * n_fds);
+			cmsg = CMSG_FIRSTHDR(&msg);
+			cmsg->cmsg_level = SOL_SOCKET;
+			cmsg->cmsg_type = SCM_RIGHTS;
+			cmsg->cmsg_len = CMSG_LEN(sizeof(int) * n_fds);
+			memcpy(CMSG_DATA(cmsg), fds, sizeof(int) * n_fds);
+		}
+
+		n = sendmsg(sock, &msg, MSG_NOSIGNAL);
+		if(n < 0) {
+			if(EINTR == errno) continue;
+			return -1;
+		}
+		n_fds = 0;
+
+		/* Skip sent bytes */
+		while(iovcnt > 0 && (size_t)n >= iov->iov_len) {
+			n -= iov->iov_len;
+			iov++;
+			iovcnt--;
+		}
+		if(n) {
+			iov->iov_base = (char *)iov->iov_base + n;
+			iov->iov_len -= n;
+		}
+	}
+	return 0;
+}
+
+/**
+ * Receive len bytes. If fds is not NULL, fds passed with the bytes are received into it.
+ */
+static int
+_bundle_recvmsg_all(int sock, void *buf, size_t len, int *fds, int *n_fds)
+{
+	struct msghdr msg;
+	struct cmsghdr *cmsg;
+	struct iovec iov;
+	frame_cmsg_t cbuf;
+	ssize_t n;
+	size_t done = 0;
+	int i, cnt;
+
+	while(done < len) {
+		memset(&msg, 0, sizeof(msg));
+		iov.iov_base = (char *)buf + done;
+		iov.iov_len = len - done;
+		msg.msg_iov = &iov;
+		msg.msg_iovlen = 1;
+		if(fds) {
+			msg.msg_control = cbuf.buf;
+			msg.msg_controllen = sizeof(cbuf.buf);
+		}
+
+		n = recvmsg(sock, &msg, MSG_CMSG_CLOEXEC);
+		if(n < 0) {
+			if(EINTR == errno) continue;
+			return -1;
+		}
+
+		for(cmsg = fds ? CMSG_FIRSTHDR(&msg) : NULL; cmsg != NULL; cmsg = CMSG_NXTHDR(&msg, cmsg)) {
+			if(SOL_SOCKET != cmsg->cmsg_level || SCM_RIGHTS != cmsg->cmsg_type) continue;
+			cnt = (cmsg->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+			for(i = 0; i < cnt; i++) {
+				if(*n_fds < FRAME_MAX_FDS) memcpy(&fds[(*n_fds)++], CMSG_DATA(cmsg) + i * sizeof(int), sizeof(int));
+			}
+		}
+		if(fds && (msg.msg_flags & MSG_CTRUNC)) {
+			errno = EBADMSG;
+			return -1;
+		}
+
+		if(0 == n) {	/* Closed by peer */
+			errno = ECONNRESET;
+			return -1;
+		}
+		done += n;
+	}
+	return 0;
+}
+
+int
+bundle_send(int fd, bundle *b, int flags)
+{
+	keyval_t *kv;
+	struct iovec *iov = NULL;
+	int iovcnt, i, err;
+	int fds[FRAME_MAX_FDS];
+	int n_fds = 0;
+	unsigned char *fd_table = NULL, *p;
+	size_t fd_table_len = 0, key_size, threshold;
+	frame_header_t hdr;
+	int ret = -1;
+
+	if(fd < 0 || NULL == b) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	threshold = (flags & BUNDLE_SEND_PASS_FD) ? BUNDLE_SEND_FD_THRESHOLD : 0;
+
+	/* Move large values into memfds */
+	for(kv = b->kv_head, i = 0; kv != NULL && i < FRAME_MAX_FDS; kv = kv->next) {
+		if(!_bundle_kv_pass_fd(kv, threshold)) continue;
+		fd_table_len += FRAME_FD_ENTRY_SIZE + keyval_key_get_entry(kv->key)->len + 1;
+		i++;
+	}
+	if(fd_table_len) {
+		fd_table = malloc(fd_table_len);
+		if(NULL == fd_table) {
+			errno = ENOMEM;
+			return -1;
+		}
+	}
+	p = fd_table;
+	for(kv = b->kv_head; kv != NULL && n_fds < FRAME_MAX_FDS; kv = kv->next) {
+		if(!_bundle_kv_pass_fd(kv, threshold)) continue;
+
+		fds[n_fds] = _bundle_memfd_new(kv->val, kv->size);
+		if(fds[n_fds] < 0) goto cleanup;
+		n_fds++;
+
+		key_size = keyval_key_get_entry(kv->key)->len + 1;
+		memcpy(p, &kv->type, sizeof(int));
+		memcpy(p + sizeof(int), &key_size, sizeof(size_t));
+		memcpy(p + sizeof(int) + sizeof(size_t), &kv->size, sizeof(size_t));
+		memcpy(p + FRAME_FD_ENTRY_SIZE, kv->key, key_size);
+		p += FRAME_FD_ENTRY_SIZE + key_size;
+	}
+
+	/* Other kvs are sent from their own memory */
+	if(_bundle_encode_iov(b, 2, threshold, &iov, &iovcnt)) goto cleanup;
+
+	hdr.magic = FRAME_MAGIC;
+	hdr.n_fds = n_fds;
+	hdr.fd_table_len = fd_table_len;
+	hdr.data_len = 0;
+	for(i = 2; i < iovcnt; i++) hdr.data_len += iov[i].iov_len;
+	iov[0].iov_base = &hdr;
+	iov[0].iov_len = sizeof(hdr);
+	iov[1].iov_base = fd_table;
+	iov[1].iov_len = fd_table_len;
+
+	ret = _bundle_sendmsg_all(fd, iov, iovcnt, fds, n_fds);
+
+cleanup:
+	err = errno;
+	_bundle_close_fds(fds, n_fds);
+	free(iov);
+	free(fd_table);
+	errno = err;
+	return ret;
+}
+
+/**
+ * Unmap a value mapped by _bundle_map_fd()
+ */
+static void
+_bundle_unmap_val(void *val)
+{
+	unsigned char *base = (unsigned char *)val - sysconf(_SC_PAGESIZE);
+	size_t map_len;
+
+	memcpy(&map_len, base, sizeof(size_t));
+	munmap(base, map_len);
+}
+
+/**
+ * Map a value of size from a passed memfd, without copying it
+ * The memfd must be sealed, so that the sender cannot change it any more.
+ * A page in front of the value keeps the mapping length, for _bundle_unmap_val().
+ */
+static void *
+_bundle_map_fd(int fd, size_t size)
+{
+	size_t page = sysconf(_SC_PAGESIZE);
+	size_t map_len;
+	unsigned char *base;
+	struct stat st;
+	int seals;
+
+	seals = fcntl(fd, F_GET_SEALS);
+	if(0 > seals || (F_SEAL_SHRINK | F_SEAL_WRITE) != (seals & (F_SEAL_SHRINK | F_SEAL_WRITE))
+			|| fstat(fd, &st) || 0 == size || (uint64_t)st.st_size < size || size > SIZE_MAX - page) {
+		errno = EBADMSG;
+		return NULL;
+	}
 
-		p_m += byte_len;
-		kv = kv->next;
+	map_len = page + size;
+	base = mmap(NULL, map_len, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if(MAP_FAILED == base) {
+		errno = ENOMEM;
+		return NULL;
+	}
+	memcpy(base, &map_len, sizeof(size_t));
 
-		free(byte);
+	if(MAP_FAILED == mmap(base + page, size, PROT_READ, MAP_SHARED | MAP_FIXED, fd, 0)) {
+		munmap(base, map_len);
+		errno = ENOMEM;
+		return NULL;
 	}
+	return base + page;
+}
 
-	/*compute checksum from the data*/
-	chksum_val = g_compute_checksum_for_string(G_CHECKSUM_MD5,m+CHECKSUM_LENGTH,msize);
-	/*prefix checksum to the data */
-	memcpy(m,chksum_val,CHECKSUM_LENGTH);
-	if ( NULL != r ) {
-		/*base64 encode for whole string checksum and data*/
-		*r =(unsigned char*)g_base64_encode(m,msize+CHECKSUM_LENGTH);
-		if ( NULL != len ) *len = strlen((char*)*r);
+/**
+ * Add values passed by fds, described in fd table
+ */
+static int
+_bundle_add_fd_values(bundle *b, unsigned char *fd_table, size_t fd_table_len, int *fds, int n_fds)
+{
+	unsigned char *p = fd_table;
+	unsigned char *end = fd_table + fd_table_len;
+	int i, type;
+	size_t key_size, size;
+	char *key;
+	void *val;
+	keyval_t *pooled_kv, *kv;
+
+	for(i = 0; i < n_fds; i++) {
+		if((size_t)(end - p) < FRAME_FD_ENTRY_SIZE) goto bad_message;
+		memcpy(&type, p, sizeof(int));
+		memcpy(&key_size, p + sizeof(int), sizeof(size_t));
+		memcpy(&size, p + sizeof(int) + sizeof(size_t), sizeof(size_t));
+		p += FRAME_FD_ENTRY_SIZE;
+
+		key = (char *)p;
+		if(0 == key_size || (size_t)(end - p) < key_size || '\0' != key[key_size - 1]) goto bad_message;
+		if(BUNDLE_TYPE_STR != type && BUNDLE_TYPE_BYTE != type) goto bad_message;
+		p += key_size;
+
+		if(_bundle_check_new_key(b, key)) return -1;
+
+		val = _bundle_map_fd(fds[i], size);
+		if(NULL == val) return -1;
+		if(BUNDLE_TYPE_STR == type && '\0' != ((char *)val)[size - 1]) {
+			_bundle_unmap_val(val);
+			goto bad_message;
+		}
+
+		pooled_kv = _bundle_pool_get(b, 0);
+		kv = keyval_new(pooled_kv, key, type, NULL, 0);
+		if(NULL == kv) {
+			_bundle_pool_unget(b, pooled_kv, 0);
+			_bundle_unmap_val(val);
+			return -1;
+		}
+		keyval_adopt_val(kv, val, size, _bundle_unmap_val);
+		_bundle_append_kv(b, kv);
+	}
+	return 0;
+
+bad_message:
+	errno = EBADMSG;
+	return -1;
+}
+
+int
+bundle_recv(int fd, bundle **b)
+{
+	frame_header_t hdr;
+	int fds[FRAME_MAX_FDS];
+	int n_fds = 0;
+	unsigned char *body = NULL;
+	bundle *b_new = NULL;
+	int err;
+
+	if(fd < 0 || NULL == b) {
+		errno = EINVAL;
+		return -1;
+	}
+	*b = NULL;
+
+	if(_bundle_recvmsg_all(fd, &hdr, sizeof(hdr), fds, &n_fds)) goto error;
+	if(FRAME_MAGIC != hdr.magic || hdr.n_fds != n_fds || CHECKSUM_LENGTH > hdr.data_len
+			|| hdr.fd_table_len > SIZE_MAX - hdr.data_len) {
+		errno = EBADMSG;
+		goto error;
+	}
+
+	body = malloc(hdr.fd_table_len + hdr.data_len);
+	if(NULL == body) {
+		errno = ENOMEM;
+		goto error;
+	}
+	if(_bundle_recvmsg_all(fd, body, hdr.fd_table_len + hdr.data_len, NULL, NULL)) goto error;
+
+	b_new = bundle_decode_binary(body + hdr.fd_table_len, hdr.data_len);
+	if(NULL == b_new) goto error;
+	if(_bundle_add_fd_values(b_new, body, hdr.fd_table_len, fds, n_fds)) goto error;
+
+	_bundle_close_fds(fds, n_fds);
+	free(body);
+	*b = b_new;
+	return 0;
+
+error:
+	err = errno;
+	_bundle_close_fds(fds, n_fds);
+	free(body);
+	if(b_new) bundle_free(b_new);
+	errno = err;
+	return -1;
+}
+
+int
+bundle_encode_shared(bundle *b, const bundle_raw **r, int *len)
+{
+	bundle_raw *enc;
+	int enc_len;
+
+	if(NULL == b || NULL == r) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	if(NULL == b->enc || b->enc_gen != b->gen) {
+		if(bundle_encode_filtered(b, NULL, NULL, &enc, &enc_len)) return -1;
+		free(b->enc);
+		b->enc = enc;
+		b->enc_len = enc_len;
+		b->enc_gen = b->gen;
+	}
+
+	*r = b->enc;
+	if(len) *len = b->enc_len;
+	return 0;
+}
+
+int
+bundle_set_incremental_encode(bundle *b, int enable)
+{
+	keyval_t *kv;
+
+	if(NULL == b) {
+		errno = EINVAL;
+		return -1;
+	}
+	if(_bundle_check_writable(b)) return -1;
+
+	b->keep_encoded = enable ? 1 : 0;
+	if(!enable) {
+		for(kv = b->kv_head; kv != NULL; kv = kv->next) {
+			if(kv->encoded) {
+				free(kv->encoded);
+				kv->encoded = NULL;
+			}
+		}
+	}
+	return 0;
+}
+
+int
+bundle_encode_filtered(bundle *b, bundle_filter_t filter, void *user_data, bundle_raw **r, int *len)
+{
+	unsigned char *m;
+	size_t msize;
+
+	if(NULL == b) {
+		errno = EINVAL;
+		return -1;
 	}
+
+	m = _bundle_encode_stream(b, CHECKSUM_LENGTH, filter, user_data, 0, &msize);
+	if(unlikely(NULL == m)) return -1;
+
+	_bundle_raw_seal(m, msize, r, len);
 	free(m);
-	g_free(chksum_val);/*free checksum string */
 
 	return 0;
 }
 
+int
+bundle_get_encoded_size(bundle *b)
+{
+	keyval_t *kv;
+	size_t msize = 0;
+
+	if(NULL == b) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	for(kv = b->kv_head; kv != NULL; kv = kv->next) {
+		msize += kv->method->get_encoded_size(kv);	/* Cached in kv */
+	}
+
+	/* base64 of checksum and keyvals */
+	return ((msize + CHECKSUM_LENGTH + 2) / 3) * 4;
+}
+
 int
 bundle_free_encoded_rawdata(bundle_raw **r)
 {
@@ -458,73 +2353,362 @@ bundle *
 bundle_decode(const bundle_raw *r, const int data_size)
 {
 	bundle *b;
-	bundle_raw *p_r;
 	unsigned char *d_str;
-	unsigned int d_len_raw;
 	unsigned char *d_r;
-	unsigned int d_len;
-	char *extract_cksum;
-	gchar* compute_cksum;
+	size_t d_len;
 
 	if(NULL == r) {
 		errno = EINVAL;
 		return NULL;
 	}
 
-	extract_cksum = calloc(CHECKSUM_LENGTH+1, sizeof(char));
-	if(unlikely(NULL== extract_cksum))
-	{
-		errno = ENOMEM;
+	if(_bundle_raw_open(r, &d_str, &d_r, &d_len)) return NULL;
+
+	/* re-construct bundle */
+	b = bundle_create();
+	if(NULL == b) {
+		free(d_str);
 		return NULL;
 	}
 
-	/* base 64 decode of input string*/
-	d_str = g_base64_decode((char*)r, &d_len_raw);
-	/*extract checksum from the received string */
-	strncpy(extract_cksum,d_str,CHECKSUM_LENGTH);
-	/* compute checksum for the data */
-	compute_cksum = g_compute_checksum_for_string(G_CHECKSUM_MD5,d_str+CHECKSUM_LENGTH,d_len_raw-CHECKSUM_LENGTH);
-	/*compare checksum values- extracted from the received string and computed from the data */
-	if(strcmp(extract_cksum,compute_cksum)!=0)
-	{
-		free(extract_cksum);
-		g_free(compute_cksum);
+	if(_bundle_decode_stream(b, d_r, d_len)) {
+		free(d_str);
+		bundle_free(b);
 		return NULL;
 	}
-	d_r = d_str+CHECKSUM_LENGTH;
-	d_len= d_len_raw-CHECKSUM_LENGTH;
 
-	/* re-construct bundle */
-	b = bundle_create();
+	free(d_str);
+
+	return b;
+}
+
+int
+bundle_decode_into(bundle *b, const bundle_raw *r, const int data_size)
+{
+	unsigned char *d_str;
+	unsigned char *d_r;
+	size_t d_len;
+
+	if(NULL == b || NULL == r) {
+		errno = EINVAL;
+		return -1;
+	}
+	if(_bundle_check_writable(b)) return -1;
+
+	if(_bundle_raw_open(r, &d_str, &d_r, &d_len)) return -1;
+
+	/* Old kvs go to pool, and are reused with their value buffers */
+	bundle_clear(b);
+	if(_bundle_decode_stream(b, d_r, d_len)) {
+		free(d_str);
+		return -1;
+	}
+
+	free(d_str);
 
-	p_r = (bundle_raw *)d_r;
+	return 0;
+}
 
+bundle *
+bundle_decode_keys(const bundle_raw *r, const int data_size, const char **keys, const int n_keys)
+{
+	bundle *b;
+	unsigned char *d_str;
+	unsigned char *d_r;
+	unsigned char *p_r;
+	size_t d_len;
 	size_t bytes_read;
 	keyval_t *kv;
+	char *key;
+	int i, n_found = 0;
 
-	while(p_r < d_r + d_len - 1) {
-		kv = NULL;	// To get a new kv
+	if(NULL == r || (NULL == keys && n_keys) || 0 > n_keys) {
+		errno = EINVAL;
+		return NULL;
+	}
 
-		// Find type, and use decode function according to type
-		int type = keyval_get_type_from_encoded_byte(p_r);
+	if(_bundle_raw_open(r, &d_str, &d_r, &d_len)) return NULL;
 
-		if(keyval_type_is_array(type)) {
-			bytes_read = keyval_array_decode(p_r, (keyval_array_t **) &kv);
-		}
-		else {
-			bytes_read = keyval_decode(p_r, &kv);
+	b = bundle_create();
+	if(NULL == b) {
+		free(d_str);
+		return NULL;
+	}
+	_bundle_index_reserve(b, n_keys);
+
+	/* Other kvs are skipped by their byte_len, without decoding. Sizes are checked by _bundle_raw_open(). */
+	for(p_r = d_r; p_r < d_r + d_len && n_found < n_keys; p_r += bytes_read) {
+		bytes_read = keyval_get_byte_len_from_encoded_byte(p_r);
+
+		key = keyval_get_key_from_encoded_byte(p_r);
+		for(i = 0; i < n_keys; i++) {
+			if(keys[i] && 0 == strcmp(keys[i], key)) break;
 		}
+		if(i == n_keys) continue;
 
-		if(kv) _bundle_append_kv(b, kv);
-		else { break; }
-		p_r += bytes_read;
+		kv = NULL;
+		_bundle_decode_kv(p_r, &kv);
+		if(NULL == kv) goto error;	/* errno is set by decoder */
+		_bundle_append_kv(b, kv);
+		n_found++;	/* Keys in the stream are unique */
 	}
 
-	free(extract_cksum);
-	g_free(compute_cksum);
 	free(d_str);
 
 	return b;
+
+error:
+	free(d_str);
+	bundle_free(b);
+	return NULL;
+}
+
+static int _bundle_decode_child(keyval_bundle_t *kvb);
+
+/**
+ * Make bundle read-only, so that it can be shared
+ * Lazily built data is built here, so that readers do not modify b.
+ */
+static int
+_bundle_freeze(bundle *b, const bundle_raw *r, const int data_size)
+{
+	keyval_t *kv;
+
+	b->enc = malloc(data_size + 1);
+	if(NULL == b->enc) {
+		errno = ENOMEM;
+		return -1;
+	}
+	memcpy(b->enc, r, data_size);
+	b->enc[data_size] = '\0';
+	b->enc_len = data_size;
+	b->enc_gen = b->gen;
+
+	if(NULL == _bundle_get_sorted(b)) return -1;
+	for(kv = b->kv_head; kv != NULL; kv = kv->next) {
+		kv->method->get_encoded_size(kv);
+		/* Children are decoded and frozen here, so that bundle_get_bundle() does not write */
+		if(BUNDLE_TYPE_BUNDLE == kv->type && NULL == ((keyval_bundle_t *)kv)->child
+				&& _bundle_decode_child((keyval_bundle_t *)kv)) return -1;
+	}
+
+	b->ref = 1;
+	b->frozen = 1;
+	return 0;
+}
+
+/**
+ * Get hash of the checksum in front of bundle_raw, without decoding all of it
+ * Checksum is a digest of the data, so its leading hex digits are used as they are.
+ */
+static int
+_bundle_raw_hash_checksum(const bundle_raw *r, size_t len, unsigned int *hash)
+{
+	unsigned char checksum[CHECKSUM_LENGTH + 3];	/* Last base64 quantum may give 2 more bytes */
+	char hex[9];
+	gint state = 0;
+	guint save = 0;
+	size_t b64_len = (CHECKSUM_LENGTH + 2) / 3 * 4;	/* base64 chars which have the checksum */
+
+	if(len < b64_len) return -1;
+	if(g_base64_decode_step((const gchar *)r, b64_len, checksum, &state, &save) < CHECKSUM_LENGTH) return -1;
+
+	memcpy(hex, checksum, 8);
+	hex[8] = '\0';
+	*hash = (unsigned int)strtoul(hex, NULL, 16);
+	return 0;
+}
+
+/**
+ * Find a cached bundle of r, and take a reference to it
+ * Checksums may collide, so encoded data is compared, too.
+ * @pre	decode_cache lock is held
+ * @return	Cached bundle, or NULL if it is not cached.
+ */
+static bundle *
+_bundle_decode_cache_get(unsigned int hash, const bundle_raw *r, size_t len)
+{
+	decode_cache_entry_t *e;
+
+	if(0 == decode_cache_n_buckets) return NULL;
+
+	for(e = decode_cache_buckets[hash & (decode_cache_n_buckets - 1)]; e != NULL; e = e->hash_next) {
+		if(e->hash == hash && (size_t)e->b->enc_len == len && 0 == memcmp(e->b->enc, r, len)) break;
+	}
+	if(NULL == e) return NULL;
+
+	/* Move to front */
+	if(e->prev) {
+		e->prev->next = e->next;
+		if(e->next) e->next->prev = e->prev;
+		else decode_cache_tail = e->prev;
+		e->prev = NULL;
+		e->next = decode_cache_head;
+		decode_cache_head->prev = e;
+		decode_cache_head = e;
+	}
+
+	e->b->ref++;
+	return e->b;
+}
+
+/**
+ * Remove an entry from hash index
+ * @pre	decode_cache lock is held
+ */
+static void
+_bundle_decode_cache_unhash(decode_cache_entry_t *e)
+{
+	decode_cache_entry_t **p = &decode_cache_buckets[e->hash & (decode_cache_n_buckets - 1)];
+
+	while(*p != e) p = &(*p)->hash_next;
+	*p = e->hash_next;
+}
+
+/**
+ * Drop least recently used entries out of cache size
+ * @pre	decode_cache lock is held
+ * @return	Dropped entries whose bundles are not referenced any more, chained with next.
+ *		Free them by _bundle_decode_cache_free_dropped() after unlock,
+ *		because freeing nested bundles takes the lock.
+ */
+static decode_cache_entry_t *
+_bundle_decode_cache_trim(void)
+{
+	decode_cache_entry_t *e;
+	decode_cache_entry_t *dropped = NULL;
+
+	while(decode_cache_count > decode_cache_size) {
+		e = decode_cache_tail;
+		decode_cache_tail = e->prev;
+		if(decode_cache_tail) decode_cache_tail->next = NULL;
+		else decode_cache_head = NULL;
+		decode_cache_count--;
+		_bundle_decode_cache_unhash(e);
+
+		if(0 == --e->b->ref) {
+			e->next = dropped;
+			dropped = e;
+		}
+		else free(e);
+	}
+	return dropped;
+}
+
+static void
+_bundle_decode_cache_free_dropped(decode_cache_entry_t *e)
+{
+	decode_cache_entry_t *next;
+
+	while(e != NULL) {
+		next = e->next;
+		_bundle_destroy(e->b);
+		free(e);
+		e = next;
+	}
+}
+
+int
+bundle_decode_cache_set_size(int size)
+{
+	decode_cache_entry_t *dropped;
+	decode_cache_entry_t **buckets = NULL;
+	unsigned int n_buckets = 0;
+	decode_cache_entry_t *e;
+
+	if(0 > size) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	/* Buckets are allocated out of lock, and replaced under it */
+	if(size) {
+		n_buckets = 1;
+		while(n_buckets < (unsigned int)size) n_buckets <<= 1;
+		buckets = calloc(n_buckets, sizeof(decode_cache_entry_t *));
+		if(NULL == buckets) {
+			errno = ENOMEM;
+			return -1;
+		}
+	}
+
+	G_LOCK(decode_cache);
+	decode_cache_size = size;
+	dropped = _bundle_decode_cache_trim();
+	for(e = decode_cache_head; e != NULL; e = e->next) {
+		e->hash_next = buckets[e->hash & (n_buckets - 1)];
+		buckets[e->hash & (n_buckets - 1)] = e;
+	}
+	free(decode_cache_buckets);
+	decode_cache_buckets = buckets;
+	decode_cache_n_buckets = n_buckets;
+	G_UNLOCK(decode_cache);
+	_bundle_decode_cache_free_dropped(dropped);
+
+	return 0;
+}
+
+bundle *
+bundle_decode_cached(const bundle_raw *r, const int data_size)
+{
+	decode_cache_entry_t *e;
+	decode_cache_entry_t *dropped = NULL;
+	bundle *b, *cached;
+	unsigned int hash;
+	size_t len;
+
+	if(NULL == r || 0 > data_size) {
+		errno = EINVAL;
+		return NULL;
+	}
+
+	/* Like bundle_decode(), r is read up to its end, and data_size is not used */
+	len = strlen((const char *)r);
+	if(_bundle_raw_hash_checksum(r, len, &hash)) {
+		errno = EINVAL;
+		return NULL;
+	}
+
+	G_LOCK(decode_cache);
+	cached = _bundle_decode_cache_get(hash, r, len);
+	G_UNLOCK(decode_cache);
+	if(cached) return cached;
+
+	/* Miss. Decoded out of lock. */
+	b = bundle_decode(r, len);
+	if(NULL == b) return NULL;
+	if(_bundle_freeze(b, r, len)) {
+		_bundle_destroy(b);
+		return NULL;
+	}
+
+	G_LOCK(decode_cache);
+	if(decode_cache_size) {
+		/* Another caller may have cached the same data meanwhile */
+		cached = _bundle_decode_cache_get(hash, r, len);
+		e = cached ? NULL : calloc(1, sizeof(decode_cache_entry_t));
+		if(e) {	/* On failure, b is just not cached */
+			e->b = b;
+			e->hash = hash;
+			b->ref++;	/* For cache */
+			e->next = decode_cache_head;
+			if(decode_cache_head) decode_cache_head->prev = e;
+			else decode_cache_tail = e;
+			decode_cache_head = e;
+			e->hash_next = decode_cache_buckets[hash & (decode_cache_n_buckets - 1)];
+			decode_cache_buckets[hash & (decode_cache_n_buckets - 1)] = e;
+			decode_cache_count++;
+			dropped = _bundle_decode_cache_trim();
+		}
+	}
+	G_UNLOCK(decode_cache);
+	_bundle_decode_cache_free_dropped(dropped);
+
+	if(cached) {
+		_bundle_destroy(b);	/* Not shared yet */
+		return cached;
+	}
+	return b;
 }
 
 struct _argv_idx {
@@ -590,8 +2774,8 @@ int bundle_free_exported_argv(int argc, char ***argv)
 	if(!*argv) return -1;		/*TC_FIX : fix for double free- sigabrt */
 	
 	int i;
-	for(i=1; i < argc; i+=2) {
-		free((*argv)[i+1]);
+	for(i=3; i < argc; i+=2) {	/* Only values are allocated. Keys are in the bundle. */
+		free((*argv)[i]);
 	}
 
 	free(*argv);
@@ -625,15 +2809,13 @@ bundle_import_from_argv(int argc, char **argv)
 		return b;
 	}
 	/*BUNDLE_LOG_PRINT("\nit is encoded");*/
-	int idx, type;
+	int idx;
 	keyval_t *kv = NULL;
-	keyval_array_t *kva = NULL;
 	unsigned char *byte = NULL;
 	char *encoded_byte;
-	unsigned int byte_size;
-	for(idx = 2; idx < argc; idx = idx+2) {  // start idx from 2 as argv[1] is encoded
+	gsize byte_size;
+	for(idx = 2; idx + 1 < argc; idx = idx+2) {  // start idx from 2 as argv[1] is encoded
 		kv = NULL;
-		kva = NULL;
 
 		encoded_byte = argv[idx+1];
 
@@ -641,21 +2823,15 @@ bundle_import_from_argv(int argc, char **argv)
 		byte = g_base64_decode(encoded_byte, &byte_size);
 		if(NULL == byte) goto err_cleanup;
 
-		type = keyval_get_type_from_encoded_byte(byte);
-		if(keyval_type_is_array(type)) {
-			if(0 == keyval_array_decode(byte, &kva)) {
-				// TODO: error!
-				BUNDLE_EXCEPTION_PRINT("Unable to Decode array\n");
-			}
-			kv = (keyval_t *)kva;
+		// Decoded by its type, as in bundle_decode(), so that nested bundles get keyval_bundle_t
+		if(0 == byte_size || _bundle_check_encoded_kv(byte, byte_size) != byte_size) {
+			BUNDLE_EXCEPTION_PRINT("Broken keyval: %s\n", argv[idx]);
 		}
-		else {
-			if(0 == keyval_decode(byte, &kv)) {
-				// TODO: error!
-				BUNDLE_EXCEPTION_PRINT("Unable to Decode\n");
-			}
+		else if(0 == _bundle_decode_kv(byte, &kv)) {
+			// TODO: error!
+			BUNDLE_EXCEPTION_PRINT("Unable to Decode\n");
 		}
-		_bundle_append_kv(b, kv);
+		if(kv) _bundle_append_kv(b, kv);
 
 		free(byte);
 		byte = NULL;
@@ -698,11 +2874,13 @@ bundle_get_array_val_size(bundle *b, const char *key, const void *val_ptr)
 {
 	return 0;
 }
-/*static int
+static int
 bundle_set_array_val(bundle *b, const char *key, const int type, const unsigned int idx, const void *val, const size_t size)
 {
 	//void **array = NULL;
 
+	if(_bundle_check_writable(b)) return -1;
+
 	keyval_t *kv = _bundle_find_kv(b, key);
 	if(NULL == kv) return -1;
 
@@ -728,8 +2906,9 @@ bundle_set_array_val(bundle *b, const char *key, const int type, const unsigned
 		return -1;
 	}
 
-	return keyval_array_set_element(kva, idx, val, size);
-}*/
+	_bundle_modified(b);
+	return keyval_array_set_element(kva, idx, (void *)val, size);
+}
 
 
 int
@@ -738,6 +2917,33 @@ bundle_add_str_array(bundle *b, const char *key, const char **str_array, const i
 	return _bundle_add_kv(b, key, str_array, 0, BUNDLE_TYPE_STR_ARRAY, len);
 }
 
+int
+bundle_add_str_array_take(bundle *b, char *key, char **str_array, const int len, bundle_free_func_t free_fn)
+{
+	keyval_t *pooled_kv;
+	keyval_array_t *new_kva;
+
+	if(0 > len || (!str_array && len)) { errno = EINVAL; return -1; }
+	if(_bundle_check_new_key(b, key)) return -1;
+
+	pooled_kv = _bundle_pool_get(b, 1);
+	new_kva = keyval_array_new_take((keyval_array_t *)pooled_kv, key, BUNDLE_TYPE_STR_ARRAY, (void **)str_array, len, free_fn);
+	if(!new_kva) {
+		_bundle_pool_unget(b, pooled_kv, 1);
+		return -1;
+	}
+
+	_bundle_append_kv(b, (keyval_t *)new_kva);
+	return 0;
+}
+
+int
+bundle_set_str_array(bundle *b, const char *key, const char **str_array, const int len)
+{
+	if(0 > len) { errno = EINVAL; return -1; }
+	return _bundle_set_kv(b, key, str_array, 0, BUNDLE_TYPE_STR_ARRAY, len);
+}
+
 
 int
 bundle_get_val_array(bundle *b, const char *key, char ***str_array, int *len)
@@ -755,38 +2961,207 @@ const char ** bundle_get_str_array(bundle *b, const char *key,int *len)
 
 }
 
+// primitive types
+static int
+_bundle_get_primitive(bundle *b, const char *key, const int type, void *val, const size_t size)
+{
+	void *v = NULL;
+
+	if(_bundle_get_val(b, key, type, &v, NULL, NULL, NULL)) return -1;
+	if(val) memcpy(val, v, size);
+	return 0;
+}
 
 int
-bundle_compare(bundle *b1, bundle *b2)
+bundle_add_int64(bundle *b, const char *key, int64_t val)
 {
-	if(!b1 || !b2) return -1;
+	return _bundle_add_kv(b, key, &val, sizeof(int64_t), BUNDLE_TYPE_INT64, 1);
+}
 
-	keyval_t *kv1, *kv2;
-	//keyval_array_t *kva1, *kva2;
-	//char *key;
+int
+bundle_get_int64(bundle *b, const char *key, int64_t *val)
+{
+	return _bundle_get_primitive(b, key, BUNDLE_TYPE_INT64, val, sizeof(int64_t));
+}
 
-	if(bundle_get_count(b1) != bundle_get_count(b2)) return 1;
-	for(kv1 = b1->kv_head; kv1 != NULL; kv1 = kv1->next) {
-		kv2 = _bundle_find_kv(b2, kv1->key);
-		if(!kv2) return 1;
-		if(kv1->method->compare(kv1, kv2)) return 1;
+int
+bundle_add_double(bundle *b, const char *key, double val)
+{
+	return _bundle_add_kv(b, key, &val, sizeof(double), BUNDLE_TYPE_DOUBLE, 1);
+}
+
+int
+bundle_get_double(bundle *b, const char *key, double *val)
+{
+	return _bundle_get_primitive(b, key, BUNDLE_TYPE_DOUBLE, val, sizeof(double));
+}
+
+int
+bundle_add_bool(bundle *b, const char *key, int val)
+{
+	int v = val ? 1 : 0;
+	return _bundle_add_kv(b, key, &v, sizeof(int), BUNDLE_TYPE_BOOL, 1);
+}
+
+int
+bundle_get_bool(bundle *b, const char *key, int *val)
+{
+	return _bundle_get_primitive(b, key, BUNDLE_TYPE_BOOL, val, sizeof(int));
+}
+
+/**
+ * Primitive array is stored as a single block of len items, like a non-array value
+ */
+static int
+_bundle_add_primitive_array(bundle *b, const char *key, const int type, const void *array, const size_t item_size, const unsigned int len)
+{
+	int *items;
+	unsigned int i;
+
+	if(len > SIZE_MAX / item_size) { errno = EINVAL; return -1; }
+	if(_bundle_add_kv(b, key, array, len * item_size, type, 1)) return -1;
+
+	if(BUNDLE_TYPE_BOOL_ARRAY == type) {
+		items = b->kv_tail->val;
+		for(i = 0; i < len; i++) items[i] = items[i] ? 1 : 0;
 	}
 	return 0;
 }
 
+static int
+_bundle_get_primitive_array(bundle *b, const char *key, const int type, const void **array, const size_t item_size, unsigned int *len)
+{
+	void *v = NULL;
+	size_t size = 0;
 
+	if(_bundle_get_val(b, key, type, &v, &size, NULL, NULL)) return -1;
+	if(array) *array = v;
+	if(len) *len = size / item_size;
+	return 0;
+}
 
-#if 0
 int
-bundle_set_str_array_element(bundle *b, const char *key, const unsigned int idx, const char *val)
+bundle_add_int64_array(bundle *b, const char *key, const int64_t *array, const unsigned int len)
 {
-	if(!val) {
-		errno = EINVAL;
+	return _bundle_add_primitive_array(b, key, BUNDLE_TYPE_INT64_ARRAY, array, sizeof(int64_t), len);
+}
+
+int
+bundle_get_int64_array(bundle *b, const char *key, const int64_t **array, unsigned int *len)
+{
+	return _bundle_get_primitive_array(b, key, BUNDLE_TYPE_INT64_ARRAY, (const void **)array, sizeof(int64_t), len);
+}
+
+int
+bundle_add_double_array(bundle *b, const char *key, const double *array, const unsigned int len)
+{
+	return _bundle_add_primitive_array(b, key, BUNDLE_TYPE_DOUBLE_ARRAY, array, sizeof(double), len);
+}
+
+int
+bundle_get_double_array(bundle *b, const char *key, const double **array, unsigned int *len)
+{
+	return _bundle_get_primitive_array(b, key, BUNDLE_TYPE_DOUBLE_ARRAY, (const void **)array, sizeof(double), len);
+}
+
+int
+bundle_add_bool_array(bundle *b, const char *key, const int *array, const unsigned int len)
+{
+	return _bundle_add_primitive_array(b, key, BUNDLE_TYPE_BOOL_ARRAY, array, sizeof(int), len);
+}
+
+int
+bundle_get_bool_array(bundle *b, const char *key, const int **array, unsigned int *len)
+{
+	return _bundle_get_primitive_array(b, key, BUNDLE_TYPE_BOOL_ARRAY, (const void **)array, sizeof(int), len);
+}
+
+// bundle type
+/**
+ * Decode child bundle of kvb, and freeze it
+ * Child is read-only, because kv->val, not child, is encoded with the parent.
+ * Its bundle_raw is made from kv->val, without encoding child again.
+ */
+static int
+_bundle_decode_child(keyval_bundle_t *kvb)
+{
+	keyval_t *kv = (keyval_t *)kvb;
+	bundle *child;
+	unsigned char *m;
+	bundle_raw *r = NULL;
+	int len = 0;
+
+	if(_bundle_check_stream(kv->val, kv->size)) return -1;
+
+	child = bundle_create();
+	if(NULL == child) return -1;
+	if(_bundle_decode_stream(child, kv->val, kv->size)) {
+		bundle_free(child);
 		return -1;
 	}
-	return bundle_set_array_val(b, key, BUNDLE_TYPE_STR_ARRAY, idx, val, strlen(val)+1);
+
+	m = malloc(CHECKSUM_LENGTH + kv->size);
+	if(NULL == m) {
+		bundle_free(child);
+		errno = ENOMEM;
+		return -1;
+	}
+	if(kv->size) memcpy(m + CHECKSUM_LENGTH, kv->val, kv->size);
+	_bundle_raw_seal(m, kv->size, &r, &len);
+	free(m);
+
+	if(NULL == r || _bundle_freeze(child, r, len)) {
+		free(r);
+		bundle_free(child);
+		errno = ENOMEM;
+		return -1;
+	}
+	free(r);
+
+	kvb->child = child;	/* Its reference is owned by kvb */
+	return 0;
+}
+
+int
+bundle_add_bundle(bundle *b, const char *key, bundle *child)
+{
+	unsigned char *m;
+	size_t msize;
+	int r;
+
+	if(NULL == child || b == child) { errno = EINVAL; return -1; }
+
+	/* Child is kept as its keyval stream, without base64 and checksum */
+	m = _bundle_encode_stream(child, 0, NULL, NULL, 0, &msize);
+	if(NULL == m) return -1;
+
+	r = _bundle_add_kv(b, key, m, msize, BUNDLE_TYPE_BUNDLE, 1);
+	free(m);
+	return r;
 }
 
+int
+bundle_get_bundle(bundle *b, const char *key, bundle **child)
+{
+	keyval_bundle_t *kvb;
+	keyval_t *kv;
+
+	if(NULL == child) { errno = EINVAL; return -1; }
+
+	kv = _bundle_find_kv(b, key);
+	if(NULL == kv) return -1;
+	if(BUNDLE_TYPE_BUNDLE != kv->type) {
+		errno = ENOTSUP;
+		return -1;
+	}
+
+	/* Decode child on first access */
+	kvb = (keyval_bundle_t *)kv;
+	if(NULL == kvb->child && _bundle_decode_child(kvb)) return -1;
+
+	*child = kvb->child;
+	return 0;
+}
 
 // byte type 
 int
@@ -801,6 +3176,18 @@ bundle_get_byte(bundle *b, const char *key, void **byte, size_t *size)
 	return _bundle_get_val(b, key, BUNDLE_TYPE_BYTE, (void **) byte, size, NULL, NULL);
 }
 
+int
+bundle_add_byte_nocopy(bundle *b, const char *key, void *byte, const size_t size, bundle_free_func_t free_fn)
+{
+	if(NULL == byte && size) { errno = EINVAL; return -1; }
+
+	/* Add without value, and give byte to the new kv */
+	if(_bundle_add_kv(b, key, NULL, 0, BUNDLE_TYPE_BYTE, 1)) return -1;
+	keyval_adopt_val(b->kv_tail, byte, size, free_fn);
+
+	return 0;
+}
+
 int
 bundle_add_byte_array(bundle *b, const char *key, void **byte_array, const unsigned int len)
 {
@@ -808,7 +3195,7 @@ bundle_add_byte_array(bundle *b, const char *key, void **byte_array, const unsig
 }
 
 int
-bundle_get_byte_array(bundle *b, const char *key, void ***byte_array, unsigned int *len, unsigned int **array_element_size)
+bundle_get_byte_array(bundle *b, const char *key, void ***byte_array, unsigned int *len, size_t **array_element_size)
 {
 	return _bundle_get_val(b, key, BUNDLE_TYPE_BYTE_ARRAY, (void **)byte_array, NULL, len, array_element_size);
 }
@@ -820,5 +3207,221 @@ bundle_set_byte_array_element(bundle *b, const char *key, const unsigned int idx
 	return bundle_set_array_val(b, key, BUNDLE_TYPE_BYTE_ARRAY, idx, val, size);
 }
 
+
+int
+bundle_compare(bundle *b1, bundle *b2)
+{
+	if(!b1 || !b2) return -1;
+
+	keyval_t *kv1, *kv2;
+	//keyval_array_t *kva1, *kva2;
+	//char *key;
+
+	if(bundle_get_count(b1) != bundle_get_count(b2)) return 1;
+	for(kv1 = b1->kv_head; kv1 != NULL; kv1 = kv1->next) {
+		kv2 = _bundle_find_kv(b2, kv1->key);
+		if(!kv2) return 1;
+		if(kv1->method->compare(kv1, kv2)) return 1;
+	}
+	return 0;
+}
+
+
+int
+bundle_merge(bundle *dst, bundle *src, int policy)
+{
+	keyval_t *kv, *next_kv, *dst_kv;
+
+	if(NULL == dst || NULL == src || dst == src) {
+		errno = EINVAL;
+		return -1;
+	}
+	if(_bundle_check_writable(dst) || _bundle_check_writable(src)) return -1;
+	if(BUNDLE_MERGE_OVERWRITE != policy && BUNDLE_MERGE_KEEP != policy
+			&& BUNDLE_MERGE_FAIL != policy) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	if(BUNDLE_MERGE_FAIL == policy) {
+		for(kv = src->kv_head; kv != NULL; kv = kv->next) {
+			if(_bundle_index_find(dst, kv->key, kv->hash)) {
+				errno = EPERM;
+				return -1;
+			}
+		}
+	}
+
+	_bundle_index_reserve(dst, dst->count + src->count);
+
+	/* Move kvs from src to dst. Hash of each kv is reused. */
+	for(kv = src->kv_head; kv != NULL; kv = next_kv) {
+		next_kv = kv->next;
+
+		dst_kv = _bundle_index_find(dst, kv->key, kv->hash);
+		if(dst_kv && BUNDLE_MERGE_KEEP == policy) continue;
+
+		_bundle_unlink_kv(src, kv);
+		if(dst_kv) _bundle_replace_kv(dst, dst_kv, kv);
+		else _bundle_append_kv(dst, kv);
+	}
+
+	errno = 0;
+	return 0;
+}
+
+int
+bundle_diff(bundle *b_old, bundle *b_new, bundle_raw **delta, int *len)
+{
+	keyval_t *kv, *kv_old;
+	keyval_t removed_kv = { 0, };
+	keyval_t **changed = NULL;
+	char **removed = NULL;
+	int n_changed = 0, n_removed = 0;
+	int i;
+	unsigned char *m, *p_m, *byte;
+	size_t msize = 0, byte_len;
+
+	if(NULL == b_old || NULL == b_new || NULL == delta) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	changed = calloc(bundle_get_count(b_new) + 1, sizeof(keyval_t *));
+	removed = calloc(bundle_get_count(b_old) + 1, sizeof(char *));
+	if(NULL == changed || NULL == removed) {
+		errno = ENOMEM;
+		goto ERR_CLEANUP;
+	}
+
+	/* Added or changed keyvals go into the delta as they are */
+	for(kv = b_new->kv_head; kv != NULL; kv = kv->next) {
+		kv_old = _bundle_find_kv(b_old, kv->key);
+		if(kv_old && 0 == kv->method->compare(kv, kv_old)) continue;
+		changed[n_changed++] = kv;
+		msize += kv->method->get_encoded_size(kv);
+	}
+
+	/* Removed keys go into the delta as keyvals without value */
+	removed_kv.type = DELTA_TYPE_REMOVED;
+	for(kv = b_old->kv_head; kv != NULL; kv = kv->next) {
+		if(_bundle_find_kv(b_new, kv->key)) continue;
+		removed[n_removed++] = kv->key;
+		removed_kv.key = kv->key;
+		keyval_set_dirty(&removed_kv);	/* Not cached for another key */
+		msize += keyval_get_encoded_size(&removed_kv);
+	}
+
+	m = calloc(msize+CHECKSUM_LENGTH, sizeof(unsigned char));
+	if(unlikely(NULL == m)) {
+		errno = ENOMEM;
+		goto ERR_CLEANUP;
+	}
+	p_m = m+CHECKSUM_LENGTH;
+
+	for(i = 0; i < n_changed; i++) {
+		byte = NULL;
+		byte_len = 0;
+		changed[i]->method->encode(changed[i], &byte, &byte_len);
+		memcpy(p_m, byte, byte_len);
+		p_m += byte_len;
+		free(byte);
+	}
+	for(i = 0; i < n_removed; i++) {
+		byte = NULL;
+		byte_len = 0;
+		removed_kv.key = removed[i];
+		keyval_set_dirty(&removed_kv);
+		keyval_encode(&removed_kv, &byte, &byte_len);
+		memcpy(p_m, byte, byte_len);
+		p_m += byte_len;
+		free(byte);
+	}
+
+	_bundle_raw_seal(m, msize, delta, len);
+	free(m);
+	free(changed);
+	free(removed);
+	return 0;
+
+ERR_CLEANUP:
+	free(changed);
+	free(removed);
+	return -1;
+}
+
+int
+bundle_patch(bundle *b, const bundle_raw *delta, const int len)
+{
+	unsigned char *d_str;
+	unsigned char *d_r;
+	unsigned char *p_r;
+	size_t d_len;
+	keyval_t **kvs;
+	keyval_t *kv, *kv_old;
+	int n = 0, i;
+
+	if(NULL == b || NULL == delta) {
+		errno = EINVAL;
+		return -1;
+	}
+	if(_bundle_check_writable(b)) return -1;
+
+	/* Sizes of all records are checked here */
+	if(_bundle_raw_open(delta, &d_str, &d_r, &d_len)) return -1;
+
+	for(p_r = d_r; p_r < d_r + d_len; p_r += keyval_get_byte_len_from_encoded_byte(p_r)) n++;
+	kvs = calloc(n + 1, sizeof(keyval_t *));
+	if(NULL == kvs) {
+		free(d_str);
+		errno = ENOMEM;
+		return -1;
+	}
+
+	/* Decode all records first, so that b is not changed on failure. Removed keys are left NULL. */
+	for(i = 0, p_r = d_r; i < n; i++, p_r += keyval_get_byte_len_from_encoded_byte(p_r)) {
+		if(DELTA_TYPE_REMOVED == keyval_get_type_from_encoded_byte(p_r)) continue;
+		_bundle_decode_kv(p_r, &kvs[i]);
+		if(NULL == kvs[i]) goto error;	/* errno is set by decoder */
+	}
+
+	for(i = 0, p_r = d_r; i < n; i++, p_r += keyval_get_byte_len_from_encoded_byte(p_r)) {
+		kv = kvs[i];
+		if(NULL == kv) {
+			bundle_del(b, keyval_get_key_from_encoded_byte(p_r));
+			continue;
+		}
+		kv_old = _bundle_find_kv(b, kv->key);
+		if(kv_old) _bundle_replace_kv(b, kv_old, kv);
+		else _bundle_append_kv(b, kv);
+	}
+
+	free(kvs);
+	free(d_str);
+	errno = 0;
+	return 0;
+
+error:
+	for(i = 0; i < n; i++) {
+		if(kvs[i]) kvs[i]->method->free(kvs[i], 1);
+	}
+	free(kvs);
+	free(d_str);
+	return -1;
+}
+
+
+#if 0
+int
+bundle_set_str_array_element(bundle *b, const char *key, const unsigned int idx, const char *val)
+{
+	if(!val) {
+		errno = EINVAL;
+		return -1;
+	}
+	return bundle_set_array_val(b, key, BUNDLE_TYPE_STR_ARRAY, idx, val, strlen(val)+1);
+}
+
+
 #endif
 
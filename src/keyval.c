@@ -28,11 +28,60 @@
 
 #include "keyval_type.h"
 #include "keyval.h"
+#include "keyval_key.h"
 #include "bundle_log.h"
 #include <stdlib.h>
 #include <errno.h>
 extern int errno;
 
+#define VAL_IS_INLINE(kv) ((kv)->val == (void *)&((kv)->primitive_val))
+
+/**
+ * Free value buffer, unless it is inline storage of kv
+ */
+static void
+_keyval_free_val(keyval_t *kv)
+{
+	if(kv->val_free) kv->val_free(kv->val);
+	else if(kv->val && !VAL_IS_INLINE(kv)) free(kv->val);
+	kv->val = NULL;
+	kv->val_free = NULL;
+	kv->capacity = 0;
+}
+
+/**
+ * Release key kept by keyval_reset()
+ */
+static void
+_keyval_release_recycled_key(keyval_t *kv)
+{
+	if(kv->recycled_key) {
+		keyval_key_unref(kv->recycled_key);
+		kv->recycled_key = NULL;
+	}
+}
+
+/**
+ * Drop cached encoding of a keyval, whose value is changed
+ */
+void
+keyval_set_dirty(keyval_t *kv)
+{
+	kv->encoded_size = 0;
+	if(kv->encoded) {
+		free(kv->encoded);
+		kv->encoded = NULL;
+	}
+}
+
+/**
+ * free function for memory which is not owned by keyval
+ */
+void
+keyval_free_nothing(void *ptr)
+{
+}
+
 static keyval_method_collection_t method = {
 	keyval_free,
 	keyval_compare,
@@ -41,8 +90,13 @@ static keyval_method_collection_t method = {
 	keyval_decode
 };
 
-keyval_t *
-keyval_new(keyval_t *kv, const char *key, const int type, const void *val, const size_t size)
+/**
+ * Create a keyval with an interned key
+ * A reference to ikey is given to kv. It is released on failure.
+ * On failure, kv given by caller is not freed. It is left cleared, to be freed or reused by caller.
+ */
+static keyval_t *
+_keyval_new(keyval_t *kv, const char *ikey, const int type, const void *val, const size_t size)
 {
 	int must_free_obj;
 	must_free_obj = kv ? 0 : 1;
@@ -51,36 +105,55 @@ keyval_new(keyval_t *kv, const char *key, const int type, const void *val, const
 		kv = calloc(1, sizeof(keyval_t));
 		if(!kv) {
 			//errno = ENOMEM;	// set by calloc
+			keyval_key_unref(ikey);
 			return NULL;
 		}
 	}
 
 	// key
-	if(kv->key) {
-		keyval_free(kv, must_free_obj);
-		return NULL;
-	}
-	kv->key = strdup(key);
-	if(!kv->key) {
-		//errno = ENOMEM;	// set by strdup
-		keyval_free(kv, must_free_obj);
+	if(kv->key) {	// Only a given kv can have a key
+		keyval_key_unref(ikey);
+		errno = EINVAL;
 		return NULL;
 	}
+	kv->key = (char *)ikey;
+	_keyval_release_recycled_key(kv);	// After ikey is referenced, not to free the same key
+	kv->hash = keyval_key_get_entry(ikey)->hash;
 
 	// elementa of primitive types
 	kv->type = type;
 	kv->size = size;
+	keyval_set_dirty(kv);
 	
-	if(size) {
+	if(size && keyval_type_is_primitive(type) && size <= sizeof(kv->primitive_val)) {
+		// primitive value is stored in kv itself
+		_keyval_free_val(kv);
+		kv->val = &(kv->primitive_val);
+		kv->capacity = sizeof(kv->primitive_val);
+		memset(kv->val, 0, kv->capacity);
+		if(val) memcpy(kv->val, val, size);
+	}
+	else if(size && kv->val && !VAL_IS_INLINE(kv) && kv->capacity >= size) {
+		// reuse value buffer of a recycled kv
+		if(val) memcpy(kv->val, val, size);
+		else memset(kv->val, 0, size);
+	}
+	else {
+		_keyval_free_val(kv);
+	}
+
+	if(size && !kv->val) {
 		kv->val = calloc(1, size);		// allocate memory unconditionally !
 		if(!kv->val) {
 			errno = ENOMEM;
-			keyval_free(kv, 1);
+			keyval_free(kv, must_free_obj);
+			if(!must_free_obj) memset(kv, 0, sizeof(keyval_t));
 			return NULL;
 		}
 		if(val) {
 			memcpy(kv->val, val, size);
 		}
+		kv->capacity = size;
 	}
 
 	// Set methods
@@ -89,6 +162,73 @@ keyval_new(keyval_t *kv, const char *key, const int type, const void *val, const
 	return kv;
 }
 
+keyval_t *
+keyval_new(keyval_t *kv, const char *key, const int type, const void *val, const size_t size)
+{
+	const char *ikey;
+
+	ikey = keyval_key_intern(key);
+	if(!ikey) {
+		//errno = ENOMEM;	// set by keyval_key_intern
+		return NULL;
+	}
+	return _keyval_new(kv, ikey, type, val, size);
+}
+
+/**
+ * Create a keyval with a key which is already interned
+ * Key is not hashed nor measured again.
+ */
+keyval_t *
+keyval_new_interned(keyval_t *kv, const char *ikey, const int type, const void *val, const size_t size)
+{
+	return _keyval_new(kv, keyval_key_ref(ikey), type, val, size);
+}
+
+/**
+ * Create a keyval, taking key and val without copying them
+ * They are freed by free_func when keyval does not need them. If free_func is NULL, they are not freed.
+ * key is interned, so it is freed as soon as keyval is created.
+ * On failure, key and val are not taken.
+ */
+keyval_t *
+keyval_new_take(keyval_t *kv, char *key, const int type, void *val, const size_t size, keyval_free_func_t free_func)
+{
+	const char *ikey;
+
+	if(kv && kv->key) {
+		errno = EINVAL;
+		return NULL;
+	}
+
+	ikey = keyval_key_intern(key);
+	if(!ikey) return NULL;
+
+	if(!kv) {
+		kv = calloc(1, sizeof(keyval_t));
+		if(!kv) {
+			//errno = ENOMEM;	// set by calloc
+			keyval_key_unref(ikey);
+			return NULL;
+		}
+	}
+
+	// key
+	if(free_func) free_func(key);
+	kv->key = (char *)ikey;
+	_keyval_release_recycled_key(kv);
+	kv->hash = keyval_key_get_entry(ikey)->hash;
+
+	// value
+	kv->type = type;
+	keyval_adopt_val(kv, val, size, free_func);
+
+	// Set methods
+	kv->method = &method;
+
+	return kv;
+}
+
 void
 keyval_free(keyval_t *kv, int do_free_object)
 {
@@ -96,21 +236,48 @@ keyval_free(keyval_t *kv, int do_free_object)
 
 	if(NULL == kv) return;
 
+	keyval_set_dirty(kv);
+
 	if(kv->key) { 
-		free(kv->key);
+		keyval_key_unref(kv->key);
 		kv->key = NULL;
 	}
+	_keyval_release_recycled_key(kv);
 
-	if(NULL != kv->val) {
-		free(kv->val);
-		kv->val = NULL;
-	}
+	_keyval_free_val(kv);
 
 	if(do_free_object) free(kv);
 
 	return;
 }
 
+/**
+ * Clear a keyval to be reused by keyval_new()
+ * Value buffer is kept, so that a new value can be copied into it.
+ * A buffer larger than max_capacity is freed, not to pin a large memory.
+ * Key is kept referenced until reuse, so that decoding the same key again does not intern it again.
+ */
+void
+keyval_reset(keyval_t *kv, size_t max_capacity)
+{
+	void *val;
+	size_t capacity;
+	char *key;
+
+	keyval_set_dirty(kv);
+	if(kv->val_free || kv->capacity > max_capacity) _keyval_free_val(kv);	// Adopted value is not reused
+	val = kv->val;
+	capacity = kv->capacity;
+
+	_keyval_release_recycled_key(kv);
+	key = kv->key;
+	memset(kv, 0, sizeof(keyval_t));
+
+	kv->val = val;
+	kv->capacity = capacity;
+	kv->recycled_key = key;
+}
+
 int
 keyval_get_data(keyval_t *kv, int *type, void **val, size_t *size)
 {
@@ -124,12 +291,59 @@ keyval_get_data(keyval_t *kv, int *type, void **val, size_t *size)
 	return 0;
 }
 
+/**
+ * Replace value of a keyval
+ * Value buffer is reused if the new value fits in it. Otherwise, it is reallocated.
+ */
+int
+keyval_set_val(keyval_t *kv, const void *val, const size_t size)
+{
+	void *new_val;
+
+	if(!kv || keyval_type_is_array(kv->type)) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	if(size > kv->capacity) {
+		new_val = malloc(size);
+		if(!new_val) {
+			errno = ENOMEM;
+			return -1;
+		}
+		_keyval_free_val(kv);
+		kv->val = new_val;
+		kv->capacity = size;
+	}
+	if(val && size) memcpy(kv->val, val, size);
+	kv->size = size;
+	keyval_set_dirty(kv);
+
+	return 0;
+}
+
+/**
+ * Make a keyval take val without copying it
+ * val is freed by val_free when keyval does not need it. If val_free is NULL, val is not freed.
+ */
+void
+keyval_adopt_val(keyval_t *kv, void *val, const size_t size, keyval_free_func_t val_free)
+{
+	_keyval_free_val(kv);
+
+	kv->val = val;
+	kv->size = size;
+	keyval_set_dirty(kv);
+	kv->val_free = val_free ? val_free : keyval_free_nothing;
+	kv->capacity = 0;	// Never reused
+}
+
 int
 keyval_compare(keyval_t *kv1, keyval_t *kv2)
 {
 	if(!kv1 || !kv2) return -1;
 
-	if(0 != strcmp(kv1->key, kv2->key)) return 1;
+	if(kv1->key != kv2->key) return 1;	// Interned
 	if(kv1->type != kv2->type) return 1;
 	if(kv1->size != kv2->size) return 1;
 
@@ -140,20 +354,25 @@ keyval_compare(keyval_t *kv1, keyval_t *kv2)
 	return 0;
 }
 
+/**
+ * Get size of encoded keyval
+ * It is computed once, and cached until the value is changed.
+ */
 size_t
 keyval_get_encoded_size(keyval_t *kv)
 {
 	if(!kv) return 0;
+	if(kv->encoded_size) return kv->encoded_size;
 
-	size_t encoded_size 
+	kv->encoded_size
 		= sizeof(size_t) // total size
 		+ sizeof(int)	// type
 		+ sizeof(size_t) // key size
-		+ strlen(kv->key) + 1	// key (+ null byte)
+		+ keyval_key_get_entry(kv->key)->len + 1	// key (+ null byte)
 		+ sizeof(size_t)	// size
 		+ kv->size;			// val
 
-	return encoded_size;
+	return kv->encoded_size;
 }
 
 /**
@@ -179,7 +398,7 @@ keyval_encode(keyval_t *kv, unsigned char **byte, size_t *byte_len)
 
 	static const size_t sz_type = sizeof(int);
 	static const size_t sz_keysize = sizeof(size_t);
-	size_t sz_key = strlen(kv->key) + 1;
+	size_t sz_key = keyval_key_get_entry(kv->key)->len + 1;
 	static const size_t sz_size = sizeof(size_t);
 	size_t sz_val = kv->size;
 
@@ -195,7 +414,8 @@ keyval_encode(keyval_t *kv, unsigned char **byte, size_t *byte_len)
 	memcpy(p, &sz_key, sz_keysize); p += sz_keysize;
 	memcpy(p, kv->key, sz_key); p += sz_key;
 	memcpy(p, &(kv->size), sz_size); p += sz_size;
-	memcpy(p, kv->val, sz_val); p += sz_val;
+	if(sz_val) memcpy(p, kv->val, sz_val);
+	p += sz_val;
 
 	return *byte_len;
 }
@@ -207,7 +427,8 @@ keyval_encode(keyval_t *kv, unsigned char **byte, size_t *byte_len)
  * @param[in|out] kv    keyval.
  *                  If kv is NULL, new keyval_t object comes.
  *                  If kv is not NULL, given kv is used. (No new kv is created.)
- * @return        Number of bytes read from byte.
+ *                  On failure, *kv is not changed, and given kv is left to caller.
+ * @return        Number of bytes read from byte, or 0 on failure.
  */
 size_t
 keyval_decode(unsigned char *byte, keyval_t **kv)
@@ -226,12 +447,28 @@ keyval_decode(unsigned char *byte, keyval_t **kv)
 	size_t size = *((size_t *)p); p += sz_size;
 	void *val = (void *)p; p += size;
 
-	if(kv) *kv = keyval_new(*kv, key, type, val, size);	// If *kv != NULL, use given kv
+	if(kv) {
+		keyval_t *new_kv = keyval_new(*kv, key, type, val, size);	// If *kv != NULL, use given kv
+		if(!new_kv) return 0;
+		*kv = new_kv;
+	}
 
 	return byte_len;
 }
 
 
+/**
+ * Hash a key (djb2)
+ */
+unsigned int
+keyval_hash_key(const char *key)
+{
+	unsigned int hash = 5381;
+
+	while(*key) hash = (hash << 5) + hash + (unsigned char)*key++;
+	return hash;
+}
+
 int
 keyval_get_type_from_encoded_byte(unsigned char *byte)
 {
@@ -246,3 +483,16 @@ keyval_get_type_from_encoded_byte(unsigned char *byte)
 	//return (int )*(byte + sizeof(size_t));
 }
 
+size_t
+keyval_get_byte_len_from_encoded_byte(unsigned char *byte)
+{
+	// total size is at the head of encoded byte
+	return *((size_t *)byte);
+}
+
+char *
+keyval_get_key_from_encoded_byte(unsigned char *byte)
+{
+	// skip total size, type and key size
+	return (char *)(byte + sizeof(size_t) + sizeof(int) + sizeof(size_t));
+}
@@ -28,6 +28,7 @@
 
 #include "keyval_array.h"
 #include "keyval.h"
+#include "keyval_key.h"
 #include "keyval_type.h"
 #include "bundle.h"
 #include "bundle_log.h"
@@ -45,6 +46,12 @@ static keyval_method_collection_t method = {
 	(keyval_method_decode_t) keyval_array_decode
 };
 
+static void _keyval_array_release(keyval_array_t *kva, int do_free_object);
+
+/**
+ * Create a keyval_array
+ * On failure, kva given by caller is not freed. It is left cleared, to be freed or reused by caller.
+ */
 keyval_array_t *
 keyval_array_new(keyval_array_t *kva, const char *key, const int type, const void **array_val, const unsigned int len)
 {
@@ -63,7 +70,7 @@ keyval_array_new(keyval_array_t *kva, const char *key, const int type, const voi
 	keyval_t *kv = keyval_new((keyval_t *)kva, key, type, NULL, 0);
 	if(unlikely(NULL==kv))
 	{
-			errno = ENOMEM;
+			if(must_free_obj) free(kva);
 			return NULL;
 	}
 
@@ -80,14 +87,14 @@ keyval_array_new(keyval_array_t *kva, const char *key, const int type, const voi
 	kva->array_val = calloc(len, sizeof(void *));
 	if(!(kva->array_val)) {
 		errno = ENOMEM;
-		keyval_array_free(kva, 1);
+		_keyval_array_release(kva, must_free_obj);
 		return NULL;
 	}
 	// array_element_size
 	kva->array_element_size = calloc(len, sizeof(size_t));
 	if(!(kva->array_element_size)) {
 		errno = ENOMEM;
-		keyval_array_free(kva, 1);
+		_keyval_array_release(kva, must_free_obj);
 		return NULL;
 	}
 	// If avaliable, copy array val
@@ -101,7 +108,7 @@ keyval_array_new(keyval_array_t *kva, const char *key, const int type, const voi
 					len,
 					keyval_type_get_measure_size_func(type))
 				) {
-			keyval_array_free(kva, 1);
+			_keyval_array_release(kva, must_free_obj);
 			return NULL;
 		}
 	}
@@ -112,18 +119,134 @@ keyval_array_new(keyval_array_t *kva, const char *key, const int type, const voi
 	return kva;
 }
 
+/**
+ * Create a keyval_array, taking key, array_val and its items without copying them
+ * They are freed by free_func when keyval_array does not need them. If free_func is NULL, they are not freed.
+ * On failure, nothing is taken.
+ */
+keyval_array_t *
+keyval_array_new_take(keyval_array_t *kva, char *key, const int type, void **array_val, const unsigned int len, keyval_free_func_t free_func)
+{
+	size_t *array_element_size;
+	int must_free_obj;
+	int i;
+
+	keyval_type_measure_size_func_t measure_size = keyval_type_get_measure_size_func(type);
+	if(!measure_size) {
+		errno = EINVAL;
+		return NULL;
+	}
+
+	array_element_size = calloc(len ? len : 1, sizeof(size_t));
+	if(!array_element_size) {
+		errno = ENOMEM;
+		return NULL;
+	}
+
+	must_free_obj = kva ? 0 : 1;
+	if(!kva) {
+		kva = calloc(1, sizeof(keyval_array_t));
+		if(unlikely(NULL==kva)) {
+			free(array_element_size);
+			errno = ENOMEM;
+			return NULL;
+		}
+	}
+
+	// keyval setting
+	keyval_t *kv = keyval_new_take((keyval_t *)kva, key, type, NULL, 0, free_func);
+	if(unlikely(NULL==kv)) {
+		free(array_element_size);
+		if(must_free_obj) free(kva);
+		return NULL;
+	}
+
+	kv->type = kv->type | BUNDLE_TYPE_ARRAY;
+	kv->val_free = NULL;	// kv->val is not used
+
+	kva->len = len;
+	kva->array_val = array_val;
+	kva->array_free = free_func ? free_func : keyval_free_nothing;
+	kva->array_element_size = array_element_size;
+	for(i=0; i < len; i++) {
+		if(array_val[i]) kva->array_element_size[i] = measure_size(array_val[i]);
+	}
+
+	// Set methods
+	kv->method = &method;
+
+	return kva;
+}
+
+/**
+ * Free an array item
+ */
+static void
+_keyval_array_free_item(keyval_array_t *kva, int idx)
+{
+	if(kva->array_val[idx]) {
+		if(kva->array_free) kva->array_free(kva->array_val[idx]);
+		else free(kva->array_val[idx]);
+	}
+	kva->array_val[idx] = NULL;
+	if(kva->array_element_size) kva->array_element_size[idx] = 0;	// Not allocated yet, if keyval_array_new() failed
+	if(kva->array_element_capacity) kva->array_element_capacity[idx] = 0;
+}
+
+/**
+ * Replace adopted array and its items with own copies
+ * After this, array and items can be freed or reallocated as usual.
+ */
+static int
+_keyval_array_own_array(keyval_array_t *kva)
+{
+	void **array_val;
+	int i;
+
+	array_val = calloc(kva->len ? kva->len : 1, sizeof(void *));
+	if(!array_val) {
+		errno = ENOMEM;
+		return -1;
+	}
+
+	for(i=0; i < kva->len; i++) {
+		if(!kva->array_val[i]) continue;
+		array_val[i] = malloc(kva->array_element_size[i]);
+		if(!array_val[i]) {
+			while(i--) free(array_val[i]);
+			free(array_val);
+			errno = ENOMEM;
+			return -1;
+		}
+		memcpy(array_val[i], kva->array_val[i], kva->array_element_size[i]);
+	}
+
+	for(i=0; i < kva->len; i++) {
+		if(kva->array_val[i]) kva->array_free(kva->array_val[i]);
+	}
+	kva->array_free(kva->array_val);
+	kva->array_free = NULL;
+	kva->array_val = array_val;
+
+	return 0;
+}
+
 void
 keyval_array_free(keyval_array_t *kva, int do_free_object)
 {
 	if(!kva) return;
 
 	// free keyval_array elements
-	free(kva->array_element_size);
 	int i;
-	for(i=0; i<kva->len; i++) {
-		if(kva->array_val[i]) free(kva->array_val[i]);
+	if(kva->array_val) {
+		for(i=0; i<kva->len; i++) {
+			_keyval_array_free_item(kva, i);
+		}
 	}
-	free(kva->array_val);
+	free(kva->array_element_size);
+	free(kva->array_element_capacity);
+	if(kva->array_free) kva->array_free(kva->array_val);
+	else free(kva->array_val);
 	
 	// free parent
 	keyval_free((keyval_t *)kva, 0);
@@ -132,6 +255,16 @@ keyval_array_free(keyval_array_t *kva, int do_free_object)
 	if(do_free_object) free(kva);
 }
 
+/**
+ * Free kva on failure. A kva given by caller is cleared instead, and left to caller.
+ */
+static void
+_keyval_array_release(keyval_array_t *kva, int do_free_object)
+{
+	keyval_array_free(kva, do_free_object);
+	if(!do_free_object) memset(kva, 0, sizeof(keyval_array_t));
+}
+
 int 
 keyval_array_compare(keyval_array_t *kva1, keyval_array_t *kva2)
 {
@@ -141,7 +274,7 @@ keyval_array_compare(keyval_array_t *kva1, keyval_array_t *kva2)
 	kv1 = (keyval_t *)kva1;
 	kv2 = (keyval_t *)kva2;
 
-	if(0 != strcmp(kv1->key, kv2->key)) return 1;
+	if(kv1->key != kv2->key) return 1;	// Interned
 	if(kv1->type != kv2->type) return 1;
 	if(kva1->len != kva2->len) return 1;
 	int i;
@@ -197,11 +330,13 @@ keyval_array_is_idx_valid(keyval_array_t *kva, int idx)
 int
 keyval_array_set_element(keyval_array_t *kva, int idx, void *val, size_t size)
 {
+	// Adopted array is not modified in place
+	if(kva->array_free && _keyval_array_own_array(kva)) return -1;
+	keyval_set_dirty((keyval_t *)kva);
+
 	if(kva->array_val[idx]) {	// An element is already exist in the idx!
 		if(!val) {	// val==NULL means 'Free this element!' 
-			free(kva->array_val[idx]);
-			kva->array_val[idx] = NULL;
-			kva->array_element_size[idx] = 0;
+			_keyval_array_free_item(kva, idx);
 		}
 		else {
 			// Error case!
@@ -216,6 +351,7 @@ keyval_array_set_element(keyval_array_t *kva, int idx, void *val, size_t size)
 			errno = ENOMEM;
 			return -1;
 		}
+		if(kva->array_element_capacity) kva->array_element_capacity[idx] = size;
 		if(val) {
 			memcpy(kva->array_val[idx], val, size);	// val
 			kva->array_element_size[idx] = size;	// size
@@ -225,6 +361,130 @@ keyval_array_set_element(keyval_array_t *kva, int idx, void *val, size_t size)
 	return 0;
 }
 
+/**
+ * Check if element idx needs a new buffer for size bytes
+ */
+static inline int
+_keyval_array_needs_buffer(keyval_array_t *kva, int idx, size_t size)
+{
+	return idx >= kva->len || !kva->array_val[idx] || size > kva->array_element_capacity[idx];
+}
+
+/**
+ * Replace whole array of a keyval_array
+ * Array and element buffers are reused if new values fit in their capacity.
+ * Everything is allocated before kva is changed, so kva is not changed on failure.
+ */
+int
+keyval_array_set_array(keyval_array_t *kva, const void **array_val, const unsigned int len)
+{
+	keyval_t *kv = (keyval_t *)kva;
+	void **new_array_val;
+	size_t *new_array_element_size;
+	size_t *new_array_element_capacity;
+	void **new_bufs = NULL;
+	size_t size;
+	int i, n_new = 0;
+
+	keyval_type_measure_size_func_t measure_size = keyval_type_get_measure_size_func(kv->type);
+	if(!measure_size) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	// Adopted array is not modified in place
+	if(kva->array_free && _keyval_array_own_array(kva)) return -1;
+
+	// Capacity is known from sizes, until it is kept
+	if(!kva->array_element_capacity) {
+		kva->array_element_capacity = calloc(kva->len ? kva->len : 1, sizeof(size_t));
+		if(!kva->array_element_capacity) {
+			errno = ENOMEM;
+			return -1;
+		}
+		for(i=0; i < kva->len; i++) kva->array_element_capacity[i] = kva->array_element_size[i];
+	}
+
+	// Grow arrays. Items out of kva->len are not used yet.
+	if(len > kva->len) {
+		new_array_val = realloc(kva->array_val, len * sizeof(void *));
+		if(!new_array_val) {
+			errno = ENOMEM;
+			return -1;
+		}
+		kva->array_val = new_array_val;
+
+		new_array_element_size = realloc(kva->array_element_size, len * sizeof(size_t));
+		if(!new_array_element_size) {
+			errno = ENOMEM;
+			return -1;
+		}
+		kva->array_element_size = new_array_element_size;
+
+		new_array_element_capacity = realloc(kva->array_element_capacity, len * sizeof(size_t));
+		if(!new_array_element_capacity) {
+			errno = ENOMEM;
+			return -1;
+		}
+		kva->array_element_capacity = new_array_element_capacity;
+	}
+
+	// Allocate buffers which do not fit
+	for(i=0; i < len; i++) {
+		if(array_val && array_val[i] && _keyval_array_needs_buffer(kva, i, measure_size((void *)array_val[i]))) n_new++;
+	}
+	if(n_new) {
+		new_bufs = calloc(len, sizeof(void *));
+		if(!new_bufs) {
+			errno = ENOMEM;
+			return -1;
+		}
+		for(i=0; i < len; i++) {
+			if(!array_val || !array_val[i]) continue;
+			size = measure_size((void *)array_val[i]);
+			if(!_keyval_array_needs_buffer(kva, i, size)) continue;
+			new_bufs[i] = malloc(size);
+			if(!new_bufs[i]) {
+				while(i--) free(new_bufs[i]);
+				free(new_bufs);
+				errno = ENOMEM;
+				return -1;
+			}
+		}
+	}
+
+	// Nothing fails from here
+	keyval_set_dirty(kv);
+
+	// Drop elements out of new length
+	for(i=len; i < kva->len; i++) _keyval_array_free_item(kva, i);
+	for(i=kva->len; i < len; i++) {
+		kva->array_val[i] = NULL;
+		kva->array_element_size[i] = 0;
+		kva->array_element_capacity[i] = 0;
+	}
+	kva->len = len;
+
+	for(i=0; i < len; i++) {
+		if(!array_val || !array_val[i]) {
+			_keyval_array_free_item(kva, i);
+			continue;
+		}
+
+		size = measure_size((void *)array_val[i]);
+		if(new_bufs && new_bufs[i]) {
+			free(kva->array_val[i]);
+			kva->array_val[i] = new_bufs[i];
+			kva->array_element_capacity[i] = size;
+		}
+		memcpy(kva->array_val[i], array_val[i], size);
+		kva->array_element_size[i] = size;
+	}
+	free(new_bufs);
+
+	return 0;
+}
+
 int
 keyval_array_get_data(keyval_array_t *kva, int *type,
 		void ***array_val, unsigned int *len, size_t **array_element_size)
@@ -242,24 +502,32 @@ keyval_array_get_data(keyval_array_t *kva, int *type,
 	return 0;
 }
 
+/**
+ * Get size of encoded keyval_array
+ * It is computed once, and cached until the array is changed.
+ */
 size_t
 keyval_array_get_encoded_size(keyval_array_t *kva)
 {
+	keyval_t *kv = (keyval_t *)kva;
+
+	if(kv->encoded_size) return kv->encoded_size;
+
 	size_t sum_array_element_size = 0;
 	int i;
 	for(i=0; i < kva->len; i++) {
 		sum_array_element_size += kva->array_element_size[i];
 	}
-	size_t encoded_size
+	kv->encoded_size
 		= sizeof(size_t) // total size
 		+ sizeof(int) // type
 		+ sizeof(size_t) // keysize
-		+ strlen(((keyval_t *)kva)->key) + 1 // key (+ null byte)
+		+ keyval_key_get_entry(kv->key)->len + 1 // key (+ null byte)
 		+ sizeof(int) // len
 		+ kva->len * sizeof(size_t) // array_element_size
 		+ sum_array_element_size;
 
-	return encoded_size;
+	return kv->encoded_size;
 }
 
 size_t
@@ -271,13 +539,9 @@ keyval_array_encode(keyval_array_t *kva, void **byte, size_t *byte_len)
 	// Calculate memory size for kva
 	static const size_t sz_type = sizeof(int);
 	static const size_t sz_keysize = sizeof(size_t);
-	size_t sz_key = strlen(kv->key) + 1;
+	size_t sz_key = keyval_key_get_entry(kv->key)->len + 1;
 	static const unsigned int sz_len = sizeof(int);
 	size_t sz_array_element_size = kva->len * sizeof(size_t);
-	size_t sz_array_val = 0;
-	for(i=0; i < kva->len; i++) {
-		sz_array_val += kva->array_element_size[i];
-	}
 
 	// Allocate memory
 	*byte_len = keyval_array_get_encoded_size(kva);
@@ -294,7 +558,7 @@ keyval_array_encode(keyval_array_t *kva, void **byte, size_t *byte_len)
 	memcpy(p, &(kva->len), sz_len); p += sz_len;
 	memcpy(p, kva->array_element_size, sz_array_element_size); p += sz_array_element_size;
 	for(i=0; i < kva->len; i++) {
-		memcpy(p, kva->array_val[i], kva->array_element_size[i]);
+		if(kva->array_val[i]) memcpy(p, kva->array_val[i], kva->array_element_size[i]);
 		p += kva->array_element_size[i];
 	}
 
@@ -320,17 +584,19 @@ keyval_array_decode(void *byte, keyval_array_t **kva)
 	size_t *array_element_size = (size_t *) p; p += sizeof(size_t) * len;
 	void *array_val = (void *)p;
 
-	*kva = keyval_array_new(NULL, key, type, NULL, len);
+	// If *kva != NULL, use given kva. On failure, *kva is not changed, and given kva is left to caller.
+	keyval_array_t *new_kva = keyval_array_new(*kva, key, type, NULL, len);
+	if(!new_kva) return 0;
 	int i;
 	size_t elem_size = 0;
 	for(i=0; i < len; i++) {
 		elem_size += i ? array_element_size[i-1] : 0;
-		if(keyval_array_set_element(*kva, i, (void *)(array_val+elem_size), array_element_size[i])) {
-			keyval_array_free(*kva, 1);
-			*kva = NULL;
+		if(keyval_array_set_element(new_kva, i, (void *)(array_val+elem_size), array_element_size[i])) {
+			_keyval_array_release(new_kva, *kva ? 0 : 1);
 			return 0;
 		}
 	}
+	*kva = new_kva;
 
 	return byte_len;
 }
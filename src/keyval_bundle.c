@@ -0,0 +1,120 @@
+/*
+ * bundle
+ *
+ * Copyright (c) 2000 - 2011 Samsung Electronics Co., Ltd. All rights reserved.
+ *
+ * Contact: Jayoun Lee <airjany@samsung.com>, Sewook Park <sewook7.park@samsung.com>,
+ * Jaeho Lee <jaeho81.lee@samsung.com>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+
+
+
+/**
+ * keyval_bundle.c
+ * Implementation of keyval_bundle object
+ */
+
+#include "keyval_bundle.h"
+#include "keyval.h"
+#include "keyval_type.h"
+#include "bundle.h"
+#include "bundle_log.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+
+
+static keyval_method_collection_t method = {
+	(keyval_method_free_t) keyval_bundle_free,
+	keyval_compare,
+	keyval_get_encoded_size,
+	keyval_encode,
+	(keyval_method_decode_t) keyval_bundle_decode
+};
+
+keyval_bundle_t *
+keyval_bundle_new(keyval_bundle_t *kvb, const char *key, const void *stream, const size_t size)
+{
+	int must_free_obj = kvb ? 0 : 1;
+
+	if(!kvb) {
+		kvb = calloc(1, sizeof(keyval_bundle_t));
+		if(unlikely(NULL==kvb)) {
+			errno = ENOMEM;
+			return NULL;
+		}
+	}
+
+	// keyval setting. Encoded child is the value.
+	keyval_t *kv = keyval_new((keyval_t *)kvb, key, BUNDLE_TYPE_BUNDLE, stream, size);
+	if(unlikely(NULL==kv))
+	{
+			if(must_free_obj) free(kvb);	// Given kvb is left to caller
+			return NULL;
+	}
+
+	kvb->child = NULL;
+
+	// Set methods
+	kv->method = &method;
+
+	return kvb;
+}
+
+void
+keyval_bundle_free(keyval_bundle_t *kvb, int do_free_object)
+{
+	if(!kvb) return;
+
+	if(kvb->child) {
+		bundle_free(kvb->child);
+		kvb->child = NULL;
+	}
+
+	// free parent
+	keyval_free((keyval_t *)kvb, 0);
+
+	// free object
+	if(do_free_object) free(kvb);
+}
+
+size_t
+keyval_bundle_decode(unsigned char *byte, keyval_bundle_t **kvb)
+{
+	keyval_t *kv;
+	size_t byte_len;
+
+	*kvb = calloc(1, sizeof(keyval_bundle_t));
+	if(!*kvb) {
+		errno = ENOMEM;
+		return 0;
+	}
+
+	// Same layout to keyval. Decode into keyval_bundle object, which is left to here on failure.
+	kv = (keyval_t *)*kvb;
+	byte_len = keyval_decode(byte, &kv);
+	if(!byte_len) {
+		free(*kvb);
+		*kvb = NULL;
+		return 0;
+	}
+
+	// Set methods
+	kv->method = &method;
+
+	return byte_len;
+}
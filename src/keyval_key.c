@@ -0,0 +1,171 @@
+/*
+ * bundle
+ *
+ * Copyright (c) 2000 - 2011 Samsung Electronics Co., Ltd. All rights reserved.
+ *
+ * Contact: Jayoun Lee <airjany@samsung.com>, Sewook Park <sewook7.park@samsung.com>,
+ * Jaeho Lee <jaeho81.lee@samsung.com>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+
+
+
+
+/**
+ * keyval_key.c
+ * Implementation of interned key table
+ */
+
+#include "keyval_key.h"
+#include "keyval.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <glib.h>
+
+#define KEY_TABLE_MIN_SIZE 256
+
+G_LOCK_DEFINE_STATIC(key_table);
+
+static keyval_key_t **key_table;
+static size_t key_table_size;	// Number of buckets. Power of 2.
+static size_t key_table_count;	// Number of interned keys
+
+
+/**
+ * Grow table to have at least as many buckets as keys
+ * On failure, table just has longer chains.
+ */
+static void
+_keyval_key_table_grow(void)
+{
+	keyval_key_t **new_table, *e, *tmp_e;
+	size_t new_size, i;
+
+	new_size = key_table_size ? key_table_size * 2 : KEY_TABLE_MIN_SIZE;
+	new_table = calloc(new_size, sizeof(keyval_key_t *));
+	if(!new_table) return;
+
+	for(i = 0; i < key_table_size; i++) {
+		e = key_table[i];
+		while(e) {
+			tmp_e = e;
+			e = e->next;
+			tmp_e->next = new_table[tmp_e->hash & (new_size - 1)];
+			new_table[tmp_e->hash & (new_size - 1)] = tmp_e;
+		}
+	}
+
+	free(key_table);
+	key_table = new_table;
+	key_table_size = new_size;
+}
+
+/**
+ * Intern a key
+ * @return	Interned key with a new reference, or NULL on failure. Release it with keyval_key_unref().
+ */
+const char *
+keyval_key_intern(const char *key)
+{
+	keyval_key_t *e;
+	unsigned int hash;
+	size_t len;
+
+	if(!key) {
+		errno = EINVAL;
+		return NULL;
+	}
+	hash = keyval_hash_key(key);
+	len = strlen(key);
+
+	G_LOCK(key_table);
+
+	if(key_table_count >= key_table_size) _keyval_key_table_grow();
+	if(!key_table) {
+		G_UNLOCK(key_table);
+		errno = ENOMEM;
+		return NULL;
+	}
+
+	for(e = key_table[hash & (key_table_size - 1)]; e; e = e->next) {
+		if(e->hash == hash && e->len == len && 0 == memcmp(e->str, key, len)) {
+			e->ref++;
+			G_UNLOCK(key_table);
+			return e->str;
+		}
+	}
+
+	e = malloc(sizeof(keyval_key_t) + len + 1);
+	if(!e) {
+		G_UNLOCK(key_table);
+		errno = ENOMEM;
+		return NULL;
+	}
+	e->hash = hash;
+	e->ref = 1;
+	e->len = len;
+	memcpy(e->str, key, len + 1);
+
+	e->next = key_table[hash & (key_table_size - 1)];
+	key_table[hash & (key_table_size - 1)] = e;
+	key_table_count++;
+
+	G_UNLOCK(key_table);
+	return e->str;
+}
+
+/**
+ * Add a reference to an interned key
+ */
+const char *
+keyval_key_ref(const char *key)
+{
+	G_LOCK(key_table);
+	keyval_key_get_entry(key)->ref++;
+	G_UNLOCK(key_table);
+	return key;
+}
+
+/**
+ * Release a reference to an interned key
+ * The key is removed from table when its last reference is released.
+ */
+void
+keyval_key_unref(const char *key)
+{
+	keyval_key_t *e, **pe;
+
+	if(!key) return;
+	e = keyval_key_get_entry(key);
+
+	G_LOCK(key_table);
+	if(--e->ref) {
+		G_UNLOCK(key_table);
+		return;
+	}
+
+	for(pe = &key_table[e->hash & (key_table_size - 1)]; *pe; pe = &(*pe)->next) {
+		if(*pe == e) {
+			*pe = e->next;
+			break;
+		}
+	}
+	key_table_count--;
+	G_UNLOCK(key_table);
+
+	free(e);
+}
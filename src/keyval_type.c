@@ -37,10 +37,14 @@ keyval_type_init(void)
 	is_done = 1;
 }
 
+/**
+ * Check if values of type are stored as keyval_array_t
+ * Primitive arrays are stored in a single block of items, like a non-array value.
+ */
 int
 keyval_type_is_array(int type)
 {
-	if(type & BUNDLE_TYPE_ARRAY) return 1;
+	if((type & BUNDLE_TYPE_ARRAY) && !(type & BUNDLE_TYPE_PRIMITIVE)) return 1;
 	return 0;
 }
 
@@ -51,6 +55,13 @@ keyval_type_is_measurable(int type)
 	return 0;
 }
 
+int
+keyval_type_is_primitive(int type)
+{
+	if(type & BUNDLE_TYPE_PRIMITIVE) return 1;
+	return 0;
+}
+
 keyval_type_measure_size_func_t
 keyval_type_get_measure_size_func(int type)
 {
@@ -59,6 +70,15 @@ keyval_type_get_measure_size_func(int type)
 		case BUNDLE_TYPE_STR_ARRAY:
 			return keyval_type_measure_size_str;
 			break;
+		case BUNDLE_TYPE_INT64:
+		case BUNDLE_TYPE_INT64_ARRAY:
+			return keyval_type_measure_size_int64;
+		case BUNDLE_TYPE_DOUBLE:
+		case BUNDLE_TYPE_DOUBLE_ARRAY:
+			return keyval_type_measure_size_double;
+		case BUNDLE_TYPE_BOOL:
+		case BUNDLE_TYPE_BOOL_ARRAY:
+			return keyval_type_measure_size_bool;
 		default:
 			return NULL;
 	}
@@ -72,3 +92,20 @@ keyval_type_measure_size_str(void *val)
 	return strlen((char *)val) + 1;
 }
 
+size_t
+keyval_type_measure_size_int64(void *val)
+{
+	return sizeof(int64_t);
+}
+
+size_t
+keyval_type_measure_size_double(void *val)
+{
+	return sizeof(double);
+}
+
+size_t
+keyval_type_measure_size_bool(void *val)
+{
+	return sizeof(int);
+}
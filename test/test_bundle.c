@@ -15,10 +15,17 @@
  *
  */
 
+#define _GNU_SOURCE		/* memfd_create */
+
 #include <assert.h>
 #include <stdlib.h>
 #include <stdio.h>
 #include <errno.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <glib.h>
 #include "bundle.h"
 
 void test_bundle_create(void)
@@ -270,6 +277,1487 @@ void test_bundle_convert_argv(void)
 	bundle_free(b2);
 }
 
+/* Make bundle_raw of binary format data, with a new checksum */
+static bundle_raw *_test_seal_binary(unsigned char *data, size_t len)
+{
+	gchar *cksum = g_compute_checksum_for_string(G_CHECKSUM_MD5, (gchar *)data + 32, len - 32);
+	memcpy(data, cksum, 32);
+	g_free(cksum);
+	return (bundle_raw *)g_base64_encode(data, len);
+}
+
+void test_bundle_diff_patch(void)
+{
+	bundle *b1, *b2;
+	bundle_raw *delta;
+	int len;
+	const char *sa[] = { "aaa", "bbb" };
+	const char **sa_patched;
+	int sa_len = 0;
+
+	b1 = bundle_create();
+	bundle_add(b1, "k1", "v1");
+	bundle_add(b1, "k2", "v2");
+	bundle_add(b1, "k3", "v3");
+
+	b2 = bundle_dup(b1);
+	bundle_del(b2, "k1");
+	bundle_del(b2, "k2");
+	bundle_add(b2, "k2", "v2-changed");
+	bundle_add_str_array(b2, "k4", sa, 2);
+
+	assert(0 == bundle_diff(b1, b2, &delta, &len));
+	assert(0 == bundle_patch(b1, delta, len));
+	free(delta);
+
+	assert(3 == bundle_get_count(b1));
+	assert(NULL == bundle_get_val(b1, "k1"));
+	assert(0 == strcmp("v2-changed", bundle_get_val(b1, "k2")));
+	assert(0 == strcmp("v3", bundle_get_val(b1, "k3")));
+	sa_patched = bundle_get_str_array(b1, "k4", &sa_len);
+	assert(2 == sa_len && 0 == strcmp("bbb", sa_patched[1]));
+
+	/* No change makes an empty delta */
+	assert(0 == bundle_diff(b1, b2, &delta, &len));
+	assert(0 == bundle_patch(b1, delta, len));
+	assert(3 == bundle_get_count(b1));
+	free(delta);
+
+	assert(0 != bundle_patch(b1, (bundle_raw *)"corrupted", 9));
+
+	/* Broken delta changes nothing, even if its first records are valid */
+	{
+		unsigned char *data;
+		gsize data_len;
+
+		bundle_del(b2, "k3");
+		bundle_add(b2, "k5", "v5");
+		assert(0 == bundle_diff(b1, b2, &delta, &len));
+		data = g_base64_decode((char *)delta, &data_len);
+		free(delta);
+		delta = _test_seal_binary(data, data_len - 1);	/* Removed k3 is the last record */
+		assert(-1 == bundle_patch(b1, delta, strlen((char *)delta)) && EBADMSG == errno);
+		assert(3 == bundle_get_count(b1));
+		assert(NULL == bundle_get_val(b1, "k5"));
+		assert(0 == strcmp("v3", bundle_get_val(b1, "k3")));
+		g_free(delta);
+		g_free(data);
+	}
+
+	bundle_free(b1);
+	bundle_free(b2);
+}
+
+void test_bundle_set(void)
+{
+	bundle *b;
+	const char *sa1[] = { "aaa", "bbb", "ccc" };
+	const char *sa2[] = { "dddd", "e" };
+	const char **sa;
+	int len = 0;
+
+	b = bundle_create();
+
+	/* upsert */
+	assert(0 == bundle_set_str(b, "k1", "v1-long-value"));
+	assert(0 == strcmp("v1-long-value", bundle_get_val(b, "k1")));
+	assert(0 == bundle_set_str(b, "k1", "v1"));
+	assert(0 == strcmp("v1", bundle_get_val(b, "k1")));
+	assert(0 == bundle_set_str(b, "k1", "v1-longer-than-before"));
+	assert(0 == strcmp("v1-longer-than-before", bundle_get_val(b, "k1")));
+	assert(1 == bundle_get_count(b));
+
+	assert(0 == bundle_set_str_array(b, "k2", sa1, 3));
+	assert(0 == bundle_set_str_array(b, "k2", sa2, 2));
+	sa = bundle_get_str_array(b, "k2", &len);
+	assert(2 == len);
+	assert(0 == strcmp("dddd", sa[0]) && 0 == strcmp("e", sa[1]));
+	assert(0 == bundle_set_str_array(b, "k2", sa1, 3));
+	sa = bundle_get_str_array(b, "k2", &len);
+	assert(3 == len && 0 == strcmp("ccc", sa[2]));
+
+	/* Element buffer keeps its capacity, after a shorter value */
+	{
+		const char *sa3[] = { "a" };
+		const char *sa4[] = { "xyz" };
+		const char *p;
+
+		p = sa[0];
+		assert(0 == bundle_set_str_array(b, "k2", sa3, 1));
+		assert(0 == bundle_set_str_array(b, "k2", sa4, 1));
+		sa = bundle_get_str_array(b, "k2", &len);
+		assert(1 == len && p == sa[0] && 0 == strcmp("xyz", sa[0]));
+	}
+
+	/* type change replaces the keyval */
+	assert(0 == bundle_set_str(b, "k2", "v2"));
+	assert(BUNDLE_TYPE_STR == bundle_get_type(b, "k2"));
+	assert(0 == strcmp("v2", bundle_get_val(b, "k2")));
+	assert(2 == bundle_get_count(b));
+
+	assert(0 != bundle_set_str(b, "k1", NULL));
+	assert(EINVAL == errno);
+	assert(0 != bundle_set_str(b, "", "v"));
+	assert(EKEYREJECTED == errno);
+
+	bundle_free(b);
+}
+
+void test_bundle_add_get_many(void)
+{
+	bundle *b;
+	const char *keys[] = { "k1", "k2", "k3" };
+	const char *vals[] = { "v1", "v2", "v3" };
+	const char *dup_keys[] = { "k4", "k4" };
+	const char *get_keys[] = { "k3", "no_key", "k1" };
+	const char *get_vals[3];
+	char key[16];
+	int i;
+
+	b = bundle_create();
+	assert(0 == bundle_add_many(b, keys, vals, 3));
+	assert(3 == bundle_get_count(b));
+
+	/* all or nothing */
+	assert(0 != bundle_add_many(b, dup_keys, vals, 2));
+	assert(EPERM == errno);
+	assert(0 != bundle_add_many(b, keys + 2, vals, 1));
+	assert(EPERM == errno);
+	assert(3 == bundle_get_count(b));
+	assert(NULL == bundle_get_val(b, "k4"));
+
+	assert(2 == bundle_get_many(b, get_keys, get_vals, 3));
+	assert(0 == strcmp("v3", get_vals[0]));
+	assert(NULL == get_vals[1]);
+	assert(0 == strcmp("v1", get_vals[2]));
+
+	/* index grows */
+	for(i = 0; i < 100; i++) {
+		snprintf(key, sizeof(key), "key%d", i);
+		assert(0 == bundle_add(b, key, key));
+	}
+	for(i = 0; i < 100; i += 2) {
+		snprintf(key, sizeof(key), "key%d", i);
+		assert(0 == bundle_del(b, key));
+	}
+	assert(53 == bundle_get_count(b));
+	assert(0 == strcmp("key99", bundle_get_val(b, "key99")));
+	assert(NULL == bundle_get_val(b, "key98"));
+
+	bundle_free(b);
+}
+
+void test_bundle_merge(void)
+{
+	bundle *dst, *src;
+	const char *sa[] = { "aaa", "bbb" };
+
+	dst = bundle_create();
+	bundle_add(dst, "k1", "dst1");
+	bundle_add(dst, "k2", "dst2");
+
+	src = bundle_create();
+	bundle_add(src, "k2", "src2");
+	bundle_add(src, "k3", "src3");
+	bundle_add_str_array(src, "k4", sa, 2);
+
+	/* Nothing changes on failure */
+	assert(0 != bundle_merge(dst, src, BUNDLE_MERGE_FAIL));
+	assert(EPERM == errno);
+	assert(2 == bundle_get_count(dst) && 3 == bundle_get_count(src));
+
+	assert(0 == bundle_merge(dst, src, BUNDLE_MERGE_KEEP));
+	assert(4 == bundle_get_count(dst));
+	assert(0 == strcmp("dst2", bundle_get_val(dst, "k2")));
+	assert(0 == strcmp("src3", bundle_get_val(dst, "k3")));
+	assert(BUNDLE_TYPE_STR_ARRAY == bundle_get_type(dst, "k4"));
+	/* Not merged pair stays in src */
+	assert(1 == bundle_get_count(src));
+	assert(0 == strcmp("src2", bundle_get_val(src, "k2")));
+
+	assert(0 == bundle_merge(dst, src, BUNDLE_MERGE_OVERWRITE));
+	assert(4 == bundle_get_count(dst));
+	assert(0 == strcmp("src2", bundle_get_val(dst, "k2")));
+	assert(0 == bundle_get_count(src));
+
+	assert(0 != bundle_merge(dst, dst, BUNDLE_MERGE_OVERWRITE));
+	assert(EINVAL == errno);
+
+	bundle_free(dst);
+	bundle_free(src);
+}
+
+void test_bundle_capacity_clear(void)
+{
+	bundle *b;
+	const char *sa[] = { "aaa", "bbb" };
+	char key[16];
+	int i, round;
+	void *big;
+
+	b = bundle_create_with_capacity(50);
+	assert(NULL != b);
+	assert(0 == bundle_get_count(b));
+
+	for(round = 0; round < 3; round++) {
+		for(i = 0; i < 60; i++) {
+			snprintf(key, sizeof(key), "key%d", i);
+			assert(0 == bundle_add(b, key, round ? "short" : "a longer value"));
+		}
+		assert(0 == bundle_add_str_array(b, "array", sa, 2));
+		assert(61 == bundle_get_count(b));
+		assert(0 == strcmp(round ? "short" : "a longer value", bundle_get_val(b, "key59")));
+
+		assert(0 == bundle_clear(b));
+		assert(0 == bundle_get_count(b));
+		assert(NULL == bundle_get_val(b, "key0"));
+	}
+
+	assert(0 != bundle_clear(NULL));
+	assert(EINVAL == errno);
+
+	/* Large value buffer is not kept in pool */
+	big = calloc(1, 100000);
+	assert(0 == bundle_add_byte(b, "big", big, 100000));
+	assert(0 == bundle_del(b, "big"));
+	assert(0 == bundle_add(b, "small", "v"));
+	assert(0 == strcmp("v", bundle_get_val(b, "small")));
+	free(big);
+
+	bundle_free(b);
+}
+
+void test_bundle_primitive_types(void)
+{
+	bundle *b1, *b2;
+	bundle_raw *r;
+	int size_r;
+	int64_t i64 = 0;
+	double d = 0;
+	int bool_val = 0;
+	const int64_t i64_arr[] = { -1, 0, 1LL << 40 };
+	const int bool_arr[] = { 0, 7 };
+	const int64_t *i64_got = NULL;
+	const int *bool_got = NULL;
+	const double *d_got = NULL;
+	unsigned int len = 0;
+
+	b1 = bundle_create();
+	assert(0 == bundle_add_int64(b1, "i64", -1234567890123LL));
+	assert(0 == bundle_add_double(b1, "d", 3.5));
+	assert(0 == bundle_add_bool(b1, "bool", 42));
+	assert(0 == bundle_add_int64_array(b1, "i64_arr", i64_arr, 3));
+	assert(0 == bundle_add_bool_array(b1, "bool_arr", bool_arr, 2));
+	assert(0 == bundle_add_double_array(b1, "d_arr", NULL, 0));
+	assert(BUNDLE_TYPE_INT64 == bundle_get_type(b1, "i64"));
+
+	assert(0 != bundle_get_double(b1, "i64", &d));
+	assert(ENOTSUP == errno);
+
+	/* values survive encoding */
+	bundle_encode(b1, &r, &size_r);
+	b2 = bundle_decode(r, size_r);
+	free(r);
+	assert(NULL != b2);
+
+	assert(0 == bundle_get_int64(b2, "i64", &i64));
+	assert(-1234567890123LL == i64);
+	assert(0 == bundle_get_double(b2, "d", &d));
+	assert(3.5 == d);
+	assert(0 == bundle_get_bool(b2, "bool", &bool_val));
+	assert(1 == bool_val);
+
+	assert(0 == bundle_get_int64_array(b2, "i64_arr", &i64_got, &len));
+	assert(3 == len && -1 == i64_got[0] && (1LL << 40) == i64_got[2]);
+	assert(0 == bundle_get_bool_array(b2, "bool_arr", &bool_got, &len));
+	assert(2 == len && 0 == bool_got[0] && 1 == bool_got[1]);
+	assert(0 == bundle_get_double_array(b2, "d_arr", &d_got, &len));
+	assert(0 == len && NULL == d_got);
+	assert(0 != bundle_get_double_array(b2, "i64_arr", &d_got, &len));
+	assert(ENOTSUP == errno);
+
+	/* Primitive array is read as one block by generic iteration */
+	{
+		bundle_iter_t it;
+		const char *key;
+		bundle_keyval_t *kv;
+		void *val;
+		size_t size;
+
+		bundle_iter_init(b2, &it);
+		while(bundle_iter_next(&it, &key, NULL, &kv) && strcmp("i64_arr", key));
+		assert(!bundle_keyval_type_is_array(kv) && bundle_keyval_type_is_primitive_array(kv));
+		assert(0 == bundle_keyval_get_basic_val(kv, &val, &size));
+		assert(3 * sizeof(int64_t) == size && -1 == ((int64_t *)val)[0]);
+	}
+
+	/* primitive value is reused by a string */
+	assert(0 == bundle_del(b2, "i64"));
+	assert(0 == bundle_add(b2, "str", "a string longer than int64"));
+	assert(0 == strcmp("a string longer than int64", bundle_get_val(b2, "str")));
+
+	bundle_free(b1);
+	bundle_free(b2);
+}
+
+void test_bundle_nested(void)
+{
+	bundle *b1, *b2, *child, *grandchild, *c = NULL;
+	bundle_raw *r;
+	int size_r;
+
+	grandchild = bundle_create();
+	bundle_add(grandchild, "gk", "gv");
+
+	child = bundle_create();
+	bundle_add(child, "ck", "cv");
+	assert(0 == bundle_add_bundle(child, "grandchild", grandchild));
+
+	b1 = bundle_create();
+	bundle_add(b1, "k", "v");
+	assert(0 == bundle_add_bundle(b1, "child", child));
+	assert(BUNDLE_TYPE_BUNDLE == bundle_get_type(b1, "child"));
+	bundle_free(child);
+	bundle_free(grandchild);
+
+	assert(0 != bundle_add_bundle(b1, "self", b1));
+
+	bundle_encode(b1, &r, &size_r);
+	b2 = bundle_decode(r, size_r);
+	free(r);
+	assert(NULL != b2);
+
+	assert(0 == bundle_get_bundle(b2, "child", &c));
+	assert(0 == strcmp("cv", bundle_get_val(c, "ck")));
+
+	/* Child is read-only, so that it does not differ from the encoded value */
+	assert(0 != bundle_add(c, "ck2", "cv2") && EROFS == errno);
+	assert(2 == bundle_get_count(c));
+	child = bundle_dup(c);
+	assert(0 == bundle_add(child, "ck2", "cv2"));
+	assert(0 == bundle_del(b2, "child"));
+	assert(0 == bundle_add_bundle(b2, "child", child));
+	bundle_free(child);
+	assert(0 == bundle_get_bundle(b2, "child", &c));
+	assert(3 == bundle_get_count(c));
+
+	assert(0 == bundle_get_bundle(c, "grandchild", &c));
+	assert(0 == strcmp("gv", bundle_get_val(c, "gk")));
+
+	assert(0 != bundle_get_bundle(b2, "k", &c));
+	assert(ENOTSUP == errno);
+
+	bundle_free(b1);
+	bundle_free(b2);
+}
+
+static int _byte_freed;
+
+static void _free_byte(void *ptr)
+{
+	_byte_freed++;
+	free(ptr);
+}
+
+void test_bundle_nested_argv(void)
+{
+	bundle *b, *b2, *child, *got;
+	int argc;
+	char **argv = NULL;
+
+	child = bundle_create();
+	bundle_add(child, "foo", "bar");
+	b = bundle_create();
+	bundle_add(b, "k1", "v1");
+	assert(0 == bundle_add_bundle(b, "child", child));
+	bundle_free(child);
+
+	/* Nested bundle survives argv round trip */
+	argc = bundle_export_to_argv(b, &argv);
+	assert(6 == argc);
+	b2 = bundle_import_from_argv(argc, argv);
+	assert(b2 && 2 == bundle_get_count(b2));
+	assert(0 == bundle_get_bundle(b2, "child", &got));
+	assert(0 == strcmp("bar", bundle_get_val(got, "foo")));
+
+	bundle_free_exported_argv(argc, &argv);
+	bundle_free(b);
+	bundle_free(b2);
+}
+
+void test_bundle_byte(void)
+{
+	bundle *b1, *b2;
+	bundle_raw *r;
+	int size_r;
+	void *v = NULL;
+	size_t size = 0;
+	void **arr = NULL;
+	unsigned int len = 0;
+	size_t *elem_size = NULL;
+	unsigned char *big;
+	static char not_owned[] = "static";
+
+	b1 = bundle_create();
+	assert(0 == bundle_add_byte(b1, "byte", "a\0b", 3));
+	assert(0 == bundle_add_byte_array(b1, "byte_array", NULL, 2));
+	assert(0 == bundle_set_byte_array_element(b1, "byte_array", 0, "aa", 2));
+	assert(0 == bundle_set_byte_array_element(b1, "byte_array", 1, "bbb", 3));
+
+	big = malloc(4096);
+	memset(big, 0x5a, 4096);
+	_byte_freed = 0;
+	assert(0 == bundle_add_byte_nocopy(b1, "big", big, 4096, _free_byte));
+	assert(0 == bundle_get_byte(b1, "big", &v, &size));
+	assert(big == v && 4096 == size);	/* Not copied */
+	assert(0 == bundle_add_byte_nocopy(b1, "static", not_owned, sizeof(not_owned), NULL));
+
+	bundle_encode(b1, &r, &size_r);
+	b2 = bundle_decode(r, size_r);
+	free(r);
+
+	assert(0 == bundle_get_byte(b2, "byte", &v, &size));
+	assert(3 == size && 0 == memcmp("a\0b", v, 3));
+	assert(0 == bundle_get_byte_array(b2, "byte_array", &arr, &len, &elem_size));
+	assert(2 == len && 3 == elem_size[1] && 0 == memcmp("bbb", arr[1], 3));
+	assert(0 == bundle_get_byte(b2, "big", &v, &size));
+	assert(4096 == size && 0x5a == ((unsigned char *)v)[4095]);
+
+	assert(0 == bundle_del(b1, "big"));
+	assert(1 == _byte_freed);
+	assert(0 == bundle_add_byte(b1, "big", "x", 1));	/* Adopted buffer is not reused */
+	bundle_free(b1);
+	bundle_free(b2);
+	assert(1 == _byte_freed);
+	assert(0 == strcmp("static", not_owned));
+}
+
+static int _take_freed;
+
+static void _free_taken(void *ptr)
+{
+	_take_freed++;
+	free(ptr);
+}
+
+void test_bundle_take(void)
+{
+	bundle *b1, *b2;
+	bundle_raw *r;
+	int size_r;
+	char *key, *val;
+	char **arr;
+	const char **sa;
+	const char *new_sa[] = { "aaa", "bbb" };
+	int len = 0;
+
+	_take_freed = 0;
+	b1 = bundle_create();
+
+	key = strdup("str");
+	val = strdup("taken");
+	assert(0 == bundle_add_str_take(b1, key, val, _free_taken));
+	assert(val == bundle_get_val(b1, "str"));	/* Not copied */
+
+	/* On failure, nothing is taken */
+	key = strdup("str");
+	val = strdup("dup");
+	assert(-1 == bundle_add_str_take(b1, key, val, _free_taken));
+	assert(EPERM == errno);
+	assert(1 == _take_freed);	/* Only the first key, which is interned */
+	free(key);
+	free(val);
+
+	arr = malloc(3 * sizeof(char *));
+	arr[0] = strdup("aaa");
+	arr[1] = NULL;
+	arr[2] = strdup("ccc");
+	assert(0 == bundle_add_str_array_take(b1, strdup("arr"), arr, 3, _free_taken));
+	sa = bundle_get_str_array(b1, "arr", &len);
+	assert(3 == len && arr[0] == sa[0] && NULL == sa[1]);
+
+	bundle_encode(b1, &r, &size_r);
+	b2 = bundle_decode(r, size_r);
+	free(r);
+	assert(0 == strcmp("taken", bundle_get_val(b2, "str")));
+	sa = bundle_get_str_array(b2, "arr", &len);
+	assert(3 == len && 0 == strcmp("ccc", sa[2]));
+	bundle_free(b2);
+
+	/* Changing the array drops the taken array and its items */
+	assert(0 == bundle_set_str_array(b1, "arr", new_sa, 2));
+	assert(5 == _take_freed);
+	sa = bundle_get_str_array(b1, "arr", &len);
+	assert(2 == len && 0 == strcmp("aaa", sa[0]) && 0 == strcmp("bbb", sa[1]));
+
+	assert(0 == bundle_del(b1, "str"));
+	assert(6 == _take_freed);
+	assert(0 == bundle_add_str_take(b1, "static", "value", NULL));
+	bundle_free(b1);
+	assert(6 == _take_freed);
+}
+
+static void _collect_key(const char *key, const int type, const bundle_keyval_t *kv, void *user_data)
+{
+	*(const char **)user_data = key;
+}
+
+void test_bundle_key_intern(void)
+{
+	bundle *b1, *b2;
+	const char *k1 = NULL, *k2 = NULL;
+	char key[] = "shared_key";
+
+	b1 = bundle_create();
+	b2 = bundle_create();
+	assert(0 == bundle_add(b1, key, "v1"));
+	key[0] = 'S';	/* Key is copied into table */
+	assert(0 == bundle_add(b2, "shared_key", "v2"));
+
+	bundle_foreach(b1, _collect_key, &k1);
+	bundle_foreach(b2, _collect_key, &k2);
+	assert(k1 == k2);	/* Same interned key */
+	assert(0 == strcmp("shared_key", k1));
+
+	assert(0 == bundle_del(b1, "shared_key"));
+	assert(0 == strcmp("v2", bundle_get_val(b2, "shared_key")));
+	bundle_free(b1);
+	bundle_free(b2);
+}
+
+void test_bundle_key_handle(void)
+{
+	bundle *b;
+	const bundle_key_t *k_op, *k_uri, *k_op2;
+	char *str = NULL;
+
+	assert(NULL == bundle_key_get(NULL) && EKEYREJECTED == errno);
+	assert(NULL == bundle_key_get("") && EKEYREJECTED == errno);
+
+	k_op = bundle_key_get("operation");
+	k_uri = bundle_key_get("uri");
+	k_op2 = bundle_key_get("operation");
+	assert(k_op && k_uri && k_op != k_uri);
+	assert(k_op == k_op2);
+
+	b = bundle_create();
+	assert(-1 == bundle_get_str_k(b, k_op, &str) && ENOKEY == errno);
+	assert(0 == bundle_add_str_k(b, k_op, "view"));
+	assert(-1 == bundle_add_str_k(b, k_op2, "edit") && EPERM == errno);
+	assert(0 == bundle_add(b, "uri", "http://"));
+
+	/* Handles and plain keys are interchangeable */
+	assert(0 == strcmp("view", bundle_get_val(b, "operation")));
+	assert(0 == bundle_get_str_k(b, k_uri, &str));
+	assert(0 == strcmp("http://", str));
+
+	assert(0 == bundle_del_k(b, k_op));
+	assert(-1 == bundle_del_k(b, k_op) && ENOKEY == errno);
+	assert(NULL == bundle_get_val(b, "operation"));
+	assert(1 == bundle_get_count(b));
+	bundle_free(b);
+
+	bundle_key_put(k_op);
+	bundle_key_put(k_op2);
+	bundle_key_put(k_uri);
+}
+
+void test_bundle_iter(void)
+{
+	bundle *b;
+	bundle_iter_t it;
+	const char *key;
+	int type;
+	bundle_keyval_t *kv;
+	int n;
+
+	assert(-1 == bundle_iter_init(NULL, &it) && EINVAL == errno);
+
+	b = bundle_create();
+	assert(0 == bundle_iter_init(b, &it));
+	assert(0 == bundle_iter_next(&it, &key, &type, &kv));
+
+	bundle_add(b, "k1", "v1");
+	bundle_add(b, "__AUL_k2", "v2");
+	bundle_add_str_array(b, "k3", NULL, 2);
+	bundle_add(b, "k4", "v4");
+
+	/* Insertion order, and early exit */
+	n = 0;
+	bundle_iter_init(b, &it);
+	while(bundle_iter_next(&it, &key, &type, &kv)) {
+		n++;
+		if(0 == strncmp(key, "__AUL_", 6)) break;
+	}
+	assert(2 == n && 0 == strcmp("__AUL_k2", key) && BUNDLE_TYPE_STR == type);
+	assert(1 == bundle_iter_next(&it, &key, &type, &kv));
+	assert(0 == strcmp("k3", key) && BUNDLE_TYPE_STR_ARRAY == type && bundle_keyval_type_is_array(kv));
+
+	/* Deleting the current keyval while iterating */
+	n = 0;
+	bundle_iter_init(b, &it);
+	while(bundle_iter_next(&it, &key, NULL, NULL)) {
+		n++;
+		assert(0 == bundle_del(b, key));
+	}
+	assert(4 == n && 0 == bundle_get_count(b));
+
+	bundle_free(b);
+}
+
+static void _collect_prefix(const char *key, const int type, const bundle_keyval_t *kv, void *user_data)
+{
+	char *buf = user_data;
+
+	strcat(buf, key);
+	strcat(buf, ",");
+}
+
+void test_bundle_prefix(void)
+{
+	bundle *b;
+	char buf[256];
+
+	b = bundle_create();
+	assert(0 == bundle_count_prefix(b, "__AUL_"));
+	assert(-1 == bundle_count_prefix(b, NULL) && EINVAL == errno);
+
+	bundle_add(b, "__AUL_B", "1");
+	bundle_add(b, "uri", "2");
+	bundle_add(b, "__AUL_A", "3");
+	bundle_add(b, "__APP_SVC_OP", "4");
+	bundle_add(b, "__AUL", "5");
+	bundle_add_str_array(b, "__AUL_C", NULL, 1);
+
+	assert(3 == bundle_count_prefix(b, "__AUL_"));
+	assert(4 == bundle_count_prefix(b, "__AUL"));
+	assert(5 == bundle_count_prefix(b, "__A"));
+	assert(6 == bundle_count_prefix(b, ""));
+	assert(0 == bundle_count_prefix(b, "zzz"));
+
+	/* Visited in key order */
+	buf[0] = '\0';
+	assert(3 == bundle_foreach_prefix(b, "__AUL_", _collect_prefix, buf));
+	assert(0 == strcmp("__AUL_A,__AUL_B,__AUL_C,", buf));
+
+	/* Index follows changes */
+	bundle_add(b, "__AUL_0", "6");
+	bundle_del(b, "__AUL_B");
+	buf[0] = '\0';
+	bundle_foreach_prefix(b, "__AUL_", _collect_prefix, buf);
+	assert(0 == strcmp("__AUL_0,__AUL_A,__AUL_C,", buf));
+
+	assert(3 == bundle_del_prefix(b, "__AUL_"));
+	assert(3 == bundle_get_count(b));
+	assert(NULL == bundle_get_val(b, "__AUL_A"));
+	assert(0 == strcmp("5", bundle_get_val(b, "__AUL")));
+	assert(1 == bundle_count_prefix(b, "__AUL"));
+	buf[0] = '\0';
+	bundle_foreach_prefix(b, "", _collect_prefix, buf);
+	assert(0 == strcmp("__APP_SVC_OP,__AUL,uri,", buf));
+
+	bundle_clear(b);
+	assert(0 == bundle_count_prefix(b, ""));
+	bundle_free(b);
+}
+
+static int _not_internal(const char *key, const int type, const bundle_keyval_t *kv, void *user_data)
+{
+	(*(int *)user_data)++;
+	return strncmp(key, "__", 2);
+}
+
+/* Selects every other keyval it is called for */
+static int _every_other(const char *key, const int type, const bundle_keyval_t *kv, void *user_data)
+{
+	return 0 == (*(int *)user_data)++ % 2;
+}
+
+void test_bundle_project(void)
+{
+	bundle *b, *b_pub;
+	bundle_raw *r;
+	int len, n_called;
+	const char *keys[] = { "k3", "missing", "__int1" };
+	const char *sa[] = { "aa", "bb" };
+	const char **sa_out;
+	int sa_len = 0;
+
+	b = bundle_create();
+	bundle_add(b, "__int1", "i1");
+	bundle_add(b, "k1", "v1");
+	bundle_add_str_array(b, "k2", sa, 2);
+	bundle_add(b, "__int2", "i2");
+	bundle_add(b, "k3", "v3");
+
+	n_called = 0;
+	b_pub = bundle_project(b, _not_internal, &n_called);
+	assert(5 == n_called);
+	assert(3 == bundle_get_count(b_pub));
+	assert(NULL == bundle_get_val(b_pub, "__int1") && NULL == bundle_get_val(b_pub, "__int2"));
+	sa_out = bundle_get_str_array(b_pub, "k2", &sa_len);
+	assert(2 == sa_len && 0 == strcmp("bb", sa_out[1]));
+	assert(5 == bundle_get_count(b));	/* Source is not changed */
+	bundle_free(b_pub);
+
+	b_pub = bundle_project_keys(b, keys, 3);
+	assert(2 == bundle_get_count(b_pub));
+	assert(0 == strcmp("v3", bundle_get_val(b_pub, "k3")));
+	assert(0 == strcmp("i1", bundle_get_val(b_pub, "__int1")));
+	bundle_free(b_pub);
+
+	n_called = 0;
+	assert(0 == bundle_encode_filtered(b, _not_internal, &n_called, &r, &len));
+	assert(5 == n_called);
+	b_pub = bundle_decode(r, len);
+	free(r);
+	assert(3 == bundle_get_count(b_pub));
+	assert(0 == strcmp("v1", bundle_get_val(b_pub, "k1")));
+	assert(NULL == bundle_get_val(b_pub, "__int2"));
+	bundle_free(b_pub);
+
+	/* Filter with a state selects each keyval by its only call */
+	n_called = 0;
+	assert(0 == bundle_encode_filtered(b, _every_other, &n_called, &r, &len));
+	assert(5 == n_called);
+	b_pub = bundle_decode(r, len);
+	free(r);
+	assert(3 == bundle_get_count(b_pub));
+	assert(0 == strcmp("i1", bundle_get_val(b_pub, "__int1")));
+	assert(NULL == bundle_get_val(b_pub, "k1") && NULL == bundle_get_val(b_pub, "__int2"));
+	assert(0 == strcmp("v3", bundle_get_val(b_pub, "k3")));
+	bundle_free(b_pub);
+
+	assert(NULL == bundle_project(NULL, NULL, NULL) && EINVAL == errno);
+	bundle_free(b);
+}
+
+void test_bundle_encoded_size(void)
+{
+	bundle *b;
+	bundle_raw *r;
+	int len;
+	const char *sa[] = { "a", "bb", "ccc" };
+
+	assert(-1 == bundle_get_encoded_size(NULL) && EINVAL == errno);
+
+	b = bundle_create();
+	bundle_encode(b, &r, &len);
+	assert(len == bundle_get_encoded_size(b));
+	free(r);
+
+	bundle_add(b, "k1", "v1");
+	bundle_add_str_array(b, "k2", sa, 3);
+	bundle_add_int64(b, "k3", 3);
+	bundle_encode(b, &r, &len);
+	assert(len == bundle_get_encoded_size(b));
+	free(r);
+
+	/* Cached sizes follow value changes */
+	bundle_set_str(b, "k1", "a longer value");
+	bundle_set_str_array(b, "k2", sa, 1);
+	bundle_del(b, "k3");
+	bundle_add(b, "k4", "v4");
+	bundle_encode(b, &r, &len);
+	assert(len == bundle_get_encoded_size(b));
+	free(r);
+
+	bundle_free(b);
+}
+
+void test_bundle_encode_shared(void)
+{
+	bundle *b, *b2;
+	const bundle_raw *r1, *r2;
+	bundle_raw *r;
+	int len1, len2, len;
+	void **arr = NULL;
+	unsigned int arr_len = 0;
+	size_t *elem_size = NULL;
+
+	assert(-1 == bundle_encode_shared(NULL, &r1, &len1) && EINVAL == errno);
+
+	b = bundle_create();
+	bundle_add(b, "k1", "v1");
+	bundle_add_byte_array(b, "k2", NULL, 2);
+
+	assert(0 == bundle_encode_shared(b, &r1, &len1));
+	assert(0 == bundle_encode_shared(b, &r2, &len2));
+	assert(r1 == r2 && len1 == len2);	/* Not encoded again */
+
+	/* bundle_encode() copies the cached one */
+	assert(0 == bundle_encode(b, &r, &len));
+	assert(r != r1 && len == len1 && 0 == memcmp(r, r1, len));
+	free(r);
+	assert(0 == bundle_encode(b, NULL, NULL));	/* Cached path checks arguments too */
+
+	/* Any modification invalidates the cache */
+	bundle_set_str(b, "k1", "v2");
+	assert(0 == bundle_encode_shared(b, &r2, &len2));
+	b2 = bundle_decode(r2, len2);
+	assert(0 == strcmp("v2", bundle_get_val(b2, "k1")));
+	bundle_free(b2);
+
+	bundle_encode_shared(b, &r1, &len1);
+	bundle_set_byte_array_element(b, "k2", 1, "bb", 2);
+	bundle_encode(b, &r, &len);
+	b2 = bundle_decode(r, len);
+	free(r);
+	assert(0 == bundle_get_byte_array(b2, "k2", &arr, &arr_len, &elem_size));
+	assert(2 == arr_len && 2 == elem_size[1] && 0 == memcmp("bb", arr[1], 2));
+	bundle_free(b2);
+
+	bundle_encode_shared(b, &r1, &len1);
+	bundle_del(b, "k1");
+	bundle_encode_shared(b, &r2, &len2);
+	b2 = bundle_decode(r2, len2);
+	assert(1 == bundle_get_count(b2));
+	bundle_free(b2);
+
+	bundle_free(b);
+}
+
+void test_bundle_incremental_encode(void)
+{
+	bundle *b, *b2;
+	bundle_raw *r1, *r2;
+	int len1, len2;
+	const char *sa[] = { "a", "b" };
+
+	assert(-1 == bundle_set_incremental_encode(NULL, 1) && EINVAL == errno);
+
+	b = bundle_create();
+	bundle_add(b, "k1", "v1");
+	bundle_add_str_array(b, "k2", sa, 2);
+	bundle_add_int64(b, "k3", 3);
+
+	/* Same result with or without kept keyvals */
+	bundle_encode(b, &r1, &len1);
+	assert(0 == bundle_set_incremental_encode(b, 1));
+	bundle_encode(b, &r2, &len2);
+	assert(len1 == len2 && 0 == memcmp(r1, r2, len1));
+	free(r2);
+	bundle_encode(b, &r2, &len2);
+	assert(len1 == len2 && 0 == memcmp(r1, r2, len1));
+	free(r1);
+	free(r2);
+
+	/* Changed keyvals are encoded again */
+	bundle_set_str(b, "k1", "changed");
+	bundle_set_str_array(b, "k2", sa, 1);
+	bundle_del(b, "k3");
+	bundle_add(b, "k4", "v4");
+	bundle_encode(b, &r1, &len1);
+	b2 = bundle_decode(r1, len1);
+	free(r1);
+	assert(3 == bundle_get_count(b2));
+	assert(0 == strcmp("changed", bundle_get_val(b2, "k1")));
+	bundle_get_str_array(b2, "k2", &len1);
+	assert(1 == len1);
+	assert(0 == strcmp("v4", bundle_get_val(b2, "k4")));
+	bundle_free(b2);
+
+	assert(0 == bundle_set_incremental_encode(b, 0));
+	bundle_encode(b, &r1, &len1);
+	b2 = bundle_decode(r1, len1);
+	free(r1);
+	assert(3 == bundle_get_count(b2));
+	bundle_free(b2);
+
+	bundle_set_incremental_encode(b, 1);
+	bundle_encode(b, &r1, &len1);
+	free(r1);
+	bundle_free(b);	/* Kept keyvals are freed */
+}
+
+void test_bundle_canonical(void)
+{
+	bundle *b1, *b2, *b3;
+	bundle_raw *r1, *r2;
+	int len1, len2;
+	const char *sa[] = { "a", "b" };
+
+	b1 = bundle_create();
+	bundle_add(b1, "k1", "v1");
+	bundle_add_str_array(b1, "k2", sa, 2);
+	bundle_add_int64(b1, "k3", 3);
+
+	b2 = bundle_create();
+	bundle_add_int64(b2, "k3", 3);
+	bundle_add(b2, "k1", "v1");
+	bundle_add_str_array(b2, "k2", sa, 2);
+
+	/* Insertion order makes a difference */
+	bundle_encode(b1, &r1, &len1);
+	bundle_encode(b2, &r2, &len2);
+	assert(len1 == len2 && 0 != memcmp(r1, r2, len1));
+	free(r1);
+	free(r2);
+
+	/* But not in canonical encoding */
+	assert(0 == bundle_encode_with_flags(b1, BUNDLE_ENCODE_CANONICAL, &r1, &len1));
+	assert(0 == bundle_encode_with_flags(b2, BUNDLE_ENCODE_CANONICAL, &r2, &len2));
+	assert(len1 == len2 && 0 == memcmp(r1, r2, len1));
+	free(r2);
+
+	b3 = bundle_decode(r1, len1);
+	assert(3 == bundle_get_count(b3));
+	assert(0 == strcmp("v1", bundle_get_val(b3, "k1")));
+	bundle_free(b3);
+	free(r1);
+
+	assert(-1 == bundle_encode_with_flags(b1, 0x100, &r1, &len1) && EINVAL == errno);
+
+	bundle_free(b1);
+	bundle_free(b2);
+}
+
+#define N_DECODE_THREADS 8
+
+static gpointer _decode_cached_thread(gpointer data)
+{
+	return bundle_decode_cached((bundle_raw *)data, strlen((char *)data));
+}
+
+static void _test_decode_cached_concurrently(bundle_raw *r)
+{
+	GThread *threads[N_DECODE_THREADS];
+	bundle *b[N_DECODE_THREADS];
+	int i;
+
+	for(i = 0; i < N_DECODE_THREADS; i++) threads[i] = g_thread_new("decode", _decode_cached_thread, r);
+	for(i = 0; i < N_DECODE_THREADS; i++) b[i] = g_thread_join(threads[i]);
+
+	for(i = 0; i < N_DECODE_THREADS; i++) {
+		assert(b[i] && b[i] == b[0]);
+	}
+	for(i = 0; i < N_DECODE_THREADS; i++) bundle_free(b[i]);
+}
+
+void test_bundle_decode_cached(void)
+{
+	bundle *b, *b1, *b2, *b3, *b_dup;
+	bundle_raw *r1, *r2, *r;
+	int len1, len2, len;
+
+	b = bundle_create();
+	bundle_add(b, "k1", "v1");
+	bundle_encode(b, &r1, &len1);
+	bundle_add(b, "k2", "v2");
+	bundle_encode(b, &r2, &len2);
+	bundle_free(b);
+
+	/* Disabled by default. Still read-only. */
+	b1 = bundle_decode_cached(r1, len1);
+	b2 = bundle_decode_cached(r1, len1);
+	assert(b1 && b2 && b1 != b2);
+	assert(-1 == bundle_add(b1, "k3", "v3") && EROFS == errno);
+	bundle_free(b1);
+	bundle_free(b2);
+
+	assert(-1 == bundle_decode_cache_set_size(-1) && EINVAL == errno);
+	assert(0 == bundle_decode_cache_set_size(1));
+
+	b1 = bundle_decode_cached(r1, len1);
+	b2 = bundle_decode_cached(r1, len1);
+	assert(b1 == b2);	/* Not decoded again */
+	assert(0 == strcmp("v1", bundle_get_val(b1, "k1")));
+
+	/* Frozen */
+	assert(-1 == bundle_add(b1, "k3", "v3") && EROFS == errno);
+	assert(-1 == bundle_set_str(b1, "k1", "x") && EROFS == errno);
+	assert(-1 == bundle_del(b1, "k1") && EROFS == errno);
+	assert(-1 == bundle_clear(b1) && EROFS == errno);
+	assert(1 == bundle_get_count(b1));
+
+	/* Copy can be modified */
+	b_dup = bundle_dup(b1);
+	assert(0 == bundle_add(b_dup, "k3", "v3"));
+	bundle_free(b_dup);
+
+	/* Encoding is the cached data */
+	assert(0 == bundle_encode(b1, &r, &len));
+	assert(len == len1 && 0 == memcmp(r, r1, len));
+	free(r);
+
+	bundle_free(b1);
+	bundle_free(b2);
+
+	/* LRU: r2 evicts r1, and the bundle is still alive while it is used */
+	b1 = bundle_decode_cached(r1, len1);
+	b3 = bundle_decode_cached(r2, len2);
+	assert(2 == bundle_get_count(b3));
+	assert(0 == strcmp("v1", bundle_get_val(b1, "k1")));
+	b2 = bundle_decode_cached(r1, len1);
+	assert(b1 != b2);
+	bundle_free(b1);
+	bundle_free(b2);
+	bundle_free(b3);
+
+	/* Nested bundles are frozen with their parent */
+	b = bundle_create();
+	b_dup = bundle_create();
+	bundle_add(b_dup, "ck", "cv");
+	bundle_add_bundle(b, "child", b_dup);
+	bundle_add_bundle(b_dup, "grandchild", b);	/* b has child only */
+	bundle_add_bundle(b, "child2", b_dup);
+	bundle_encode(b, &r, &len);
+	bundle_free(b);
+	bundle_free(b_dup);
+	b1 = bundle_decode_cached(r, len);
+	free(r);
+	assert(0 == bundle_get_bundle(b1, "child2", &b2));
+	assert(-1 == bundle_add(b2, "ck2", "v") && EROFS == errno);
+	assert(0 == bundle_get_bundle(b2, "grandchild", &b3));
+	assert(0 == bundle_get_bundle(b3, "child", &b3));
+	assert(0 == strcmp("cv", bundle_get_val(b3, "ck")));
+	assert(-1 == bundle_add(b3, "ck2", "v") && EROFS == errno);
+	bundle_free(b1);
+
+	/* Wrong length neither truncates the cache key, nor hits other data */
+	assert(0 == bundle_decode_cache_set_size(16));
+	b1 = bundle_decode_cached(r2, 10);
+	assert(2 == bundle_get_count(b1));
+	assert(0 == bundle_encode(b1, &r, &len));
+	assert(len == len2 && 0 == memcmp(r, r2, len));
+	free(r);
+	b2 = bundle_decode_cached(r1, len2);
+	assert(b2 != b1 && 1 == bundle_get_count(b2));
+	b3 = bundle_decode_cached(r2, len2);
+	assert(b3 == b1);
+	bundle_free(b1);
+	bundle_free(b2);
+	bundle_free(b3);
+
+	/* Callers decoding the same data at once share one bundle */
+	assert(0 == bundle_decode_cache_set_size(0));
+	assert(0 == bundle_decode_cache_set_size(16));
+	_test_decode_cached_concurrently(r2);
+	assert(0 == bundle_decode_cache_set_size(1));
+
+	/* Invalid data is not cached */
+	r1[len1 - 2] ^= 1;
+	assert(NULL == bundle_decode_cached(r1, len1));
+
+	assert(0 == bundle_decode_cache_set_size(0));
+	free(r1);
+	free(r2);
+}
+
+void test_bundle_encode_iov(void)
+{
+	bundle *b, *b2;
+	struct iovec *iov;
+	int iovcnt, i, len = 0;
+	size_t size = 0;
+	unsigned char *data, *p;
+	const char *sa[] = { "a", "", "ccc" };
+	const char **sa_out;
+	int64_t i64 = 0;
+	const char *val = "v1";
+
+	b = bundle_create();
+	bundle_add(b, "k1", val);
+	bundle_add_str_array(b, "k2", sa, 3);
+	bundle_add_int64(b, "k3", -3);
+	bundle_add_byte(b, "empty", NULL, 0);
+
+	assert(0 == bundle_encode_iov(b, &iov, &iovcnt));
+	assert(1 < iovcnt);
+
+	/* Values are not copied */
+	for(i = 0; i < iovcnt; i++) {
+		if(iov[i].iov_base == (void *)bundle_get_val(b, "k1")) break;
+	}
+	assert(i < iovcnt);
+
+	for(i = 0; i < iovcnt; i++) size += iov[i].iov_len;
+	data = malloc(size);
+	for(p = data, i = 0; i < iovcnt; i++) {
+		memcpy(p, iov[i].iov_base, iov[i].iov_len);
+		p += iov[i].iov_len;
+	}
+	free(iov);
+
+	/* Same to the contiguous binary format */
+	{
+		unsigned char *bin;
+		size_t bin_len;
+
+		assert(0 == bundle_encode_binary(b, &bin, &bin_len));
+		assert(size == bin_len && 0 == memcmp(data, bin, size));
+		free(bin);
+		assert(-1 == bundle_encode_binary(b, NULL, &bin_len) && EINVAL == errno);
+	}
+
+	b2 = bundle_decode_binary(data, size);
+	assert(b2);
+	assert(4 == bundle_get_count(b2));
+	assert(0 == strcmp("v1", bundle_get_val(b2, "k1")));
+	sa_out = bundle_get_str_array(b2, "k2", &len);
+	assert(3 == len && 0 == strcmp("", sa_out[1]) && 0 == strcmp("ccc", sa_out[2]));
+	assert(0 == bundle_get_int64(b2, "k3", &i64) && -3 == i64);
+	bundle_free(b2);
+
+	/* Checksum is verified */
+	data[size - 1] ^= 1;
+	assert(NULL == bundle_decode_binary(data, size) && EBADMSG == errno);
+	free(data);
+
+	/* Same segments with kept encoded keyvals */
+	bundle_set_incremental_encode(b, 1);
+	bundle_encode_shared(b, (const bundle_raw **)&data, &len);
+	assert(0 == bundle_encode_iov(b, &iov, &iovcnt));
+	assert(5 == iovcnt);
+	free(iov);
+
+	bundle_free(b);
+}
+
+void test_bundle_send_recv(void)
+{
+	bundle *b, *b2;
+	int sv[2], queued, i;
+	size_t big_len = BUNDLE_SEND_FD_THRESHOLD + 100;
+	unsigned char *big, *out;
+	size_t out_len;
+	const char *sa[] = { "x", "yy" };
+
+	assert(0 == socketpair(AF_UNIX, SOCK_STREAM, 0, sv));
+
+	big = malloc(big_len);
+	for(i = 0; i < big_len; i++) big[i] = i & 0xff;
+
+	b = bundle_create();
+	bundle_add(b, "k1", "v1");
+	bundle_add_byte(b, "big", big, big_len);
+	bundle_add_str_array(b, "k2", sa, 2);
+
+	/* Large value is passed by a memfd */
+	assert(0 == bundle_send(sv[0], b, BUNDLE_SEND_PASS_FD));
+	assert(0 == ioctl(sv[1], FIONREAD, &queued));
+	assert(queued < BUNDLE_SEND_FD_THRESHOLD);
+	assert(0 == bundle_recv(sv[1], &b2));
+	assert(3 == bundle_get_count(b2));
+	assert(0 == strcmp("v1", bundle_get_val(b2, "k1")));
+	assert(0 == bundle_get_byte(b2, "big", (void **)&out, &out_len));
+	assert(big_len == out_len && 0 == memcmp(big, out, big_len));
+	assert(0 == (uintptr_t)out % sysconf(_SC_PAGESIZE));	/* Mapped, not copied */
+	assert(0 == strcmp("yy", bundle_get_str_array(b2, "k2", &i)[1]) && 2 == i);
+	bundle_free(b2);
+
+	/* Without the flag, all values are in the frame */
+	assert(0 == bundle_send(sv[0], b, 0));
+	assert(0 == ioctl(sv[1], FIONREAD, &queued));
+	assert(queued > big_len);
+	assert(0 == bundle_recv(sv[1], &b2));
+	assert(0 == bundle_get_byte(b2, "big", (void **)&out, &out_len));
+	assert(big_len == out_len && 0 == memcmp(big, out, big_len));
+	bundle_free(b2);
+
+	/* Unsealed memfd is rejected */
+	assert(0 == bundle_send(sv[0], b, BUNDLE_SEND_PASS_FD));
+	{
+		unsigned char frame[4096];
+		union { struct cmsghdr h; char buf[CMSG_SPACE(sizeof(int))]; } cbuf;
+		struct iovec iov = { frame, sizeof(frame) };
+		struct msghdr msg = { 0, };
+		struct cmsghdr *cmsg;
+		ssize_t frame_len;
+		int memfd;
+
+		msg.msg_iov = &iov;
+		msg.msg_iovlen = 1;
+		msg.msg_control = cbuf.buf;
+		msg.msg_controllen = sizeof(cbuf.buf);
+		frame_len = recvmsg(sv[1], &msg, 0);
+		assert(0 < frame_len && frame_len < sizeof(frame));
+		cmsg = CMSG_FIRSTHDR(&msg);
+		assert(cmsg && SCM_RIGHTS == cmsg->cmsg_type);
+		close(*(int *)CMSG_DATA(cmsg));
+
+		memfd = memfd_create("unsealed", 0);
+		assert(big_len == write(memfd, big, big_len));
+		memcpy(CMSG_DATA(cmsg), &memfd, sizeof(int));
+		iov.iov_len = frame_len;
+		assert(frame_len == sendmsg(sv[0], &msg, 0));
+		close(memfd);
+		assert(-1 == bundle_recv(sv[1], &b2) && EBADMSG == errno);
+	}
+
+	/* Peer is closed */
+	close(sv[0]);
+	assert(-1 == bundle_recv(sv[1], &b2) && ECONNRESET == errno);
+	assert(NULL == b2);
+	close(sv[1]);
+
+	bundle_free(b);
+	free(big);
+}
+
+void test_bundle_decode_into(void)
+{
+	bundle *b1, *b2, *b;
+	bundle_raw *r1, *r2;
+	int len1, len2, len;
+	const char *val;
+	const char *sa[] = { "a", "b", "c" };
+	const char **sa_out;
+
+	b1 = bundle_create();
+	bundle_add(b1, "k1", "a long value");
+	bundle_add_str_array(b1, "k2", sa, 3);
+	bundle_encode(b1, &r1, &len1);
+
+	b2 = bundle_create();
+	bundle_add(b2, "k1", "short");
+	bundle_add(b2, "k3", "v3");
+	bundle_encode(b2, &r2, &len2);
+
+	b = bundle_create_with_capacity(4);	/* Keeps nodes for reuse */
+	bundle_add(b, "old", "old value");
+	assert(0 == bundle_decode_into(b, r1, len1));
+	assert(2 == bundle_get_count(b));
+	assert(NULL == bundle_get_val(b, "old"));
+	assert(0 == strcmp("a long value", bundle_get_val(b, "k1")));
+	sa_out = bundle_get_str_array(b, "k2", &len);
+	assert(3 == len && 0 == strcmp("c", sa_out[2]));
+
+	/* Value buffer of k1 is reused */
+	val = bundle_get_val(b, "k1");
+	bundle_del(b, "k2");
+	assert(0 == bundle_decode_into(b, r2, len2));
+	assert(2 == bundle_get_count(b));
+	assert(val == bundle_get_val(b, "k1"));
+	assert(0 == strcmp("short", bundle_get_val(b, "k1")));
+	assert(0 == strcmp("v3", bundle_get_val(b, "k3")));
+
+	/* Invalid data does not change b */
+	assert(-1 == bundle_decode_into(b, (bundle_raw *)"garbage", 7));
+	assert(2 == bundle_get_count(b));
+
+	assert(-1 == bundle_decode_into(NULL, r1, len1) && EINVAL == errno);
+
+	bundle_free(b);
+	bundle_free(b1);
+	bundle_free(b2);
+	free(r1);
+	free(r2);
+}
+
+void test_bundle_decode_keys(void)
+{
+	bundle *b, *b2;
+	bundle_raw *r;
+	int len;
+	unsigned char big[1024] = { 0, };
+	const char *sa[] = { "a", "b" };
+	const char *keys[] = { "k3", NULL, "missing", "k1" };
+
+	b = bundle_create();
+	bundle_add(b, "k1", "v1");
+	bundle_add_str_array(b, "k2", sa, 2);
+	bundle_add_byte(b, "big", big, sizeof(big));
+	bundle_add(b, "k3", "v3");
+	bundle_add(b, "k4", "v4");
+	bundle_encode(b, &r, &len);
+
+	b2 = bundle_decode_keys(r, len, keys, 4);
+	assert(b2);
+	assert(2 == bundle_get_count(b2));
+	assert(0 == strcmp("v1", bundle_get_val(b2, "k1")));
+	assert(0 == strcmp("v3", bundle_get_val(b2, "k3")));
+	assert(NULL == bundle_get_val(b2, "k4"));
+	bundle_free(b2);
+
+	b2 = bundle_decode_keys(r, len, NULL, 0);
+	assert(b2 && 0 == bundle_get_count(b2));
+	bundle_free(b2);
+
+	assert(NULL == bundle_decode_keys(r, len, NULL, 1) && EINVAL == errno);
+	free(r);
+
+	/* Broken sizes with a valid checksum fail, not read out of data */
+	{
+		unsigned char *data;
+		size_t data_len, forged;
+
+		assert(0 == bundle_encode_binary(b, &data, &data_len));
+		forged = (size_t)1 << 40;
+		memcpy(data + 32, &forged, sizeof(size_t));	/* Total size of the first kv */
+		r = _test_seal_binary(data, data_len);
+		assert(NULL == bundle_decode_keys(r, strlen((char *)r), keys, 4) && EBADMSG == errno);
+		g_free(r);
+		free(data);
+
+		assert(0 == bundle_encode_binary(b, &data, &data_len));
+		r = _test_seal_binary(data, data_len - 1);	/* Last kv is cut */
+		assert(NULL == bundle_decode_keys(r, strlen((char *)r), keys, 4) && EBADMSG == errno);
+		g_free(r);
+		free(data);
+
+		assert(0 == bundle_encode_binary(b, &data, &data_len));
+		data[data_len - 3 - sizeof(size_t) - 1] = 'x';	/* Key "k4" of the last kv is not terminated */
+		r = _test_seal_binary(data, data_len);
+		assert(NULL == bundle_decode_keys(r, strlen((char *)r), keys, 4) && EBADMSG == errno);
+		g_free(r);
+		free(data);
+	}
+
+	bundle_free(b);
+}
+
+/* Encode b, with a size_t in its binary format data replaced */
+static bundle_raw *_test_forge_size(bundle *b, size_t offset, size_t size)
+{
+	unsigned char *data;
+	size_t len;
+	bundle_raw *r;
+
+	assert(0 == bundle_encode_binary(b, &data, &len));
+	memcpy(data + offset, &size, sizeof(size_t));
+	r = _test_seal_binary(data, len);
+	free(data);
+	return r;
+}
+
+void test_bundle_decode_broken(void)
+{
+	bundle *b, *b2, *child;
+	bundle_raw *r;
+	/* Offsets in binary format: checksum, total, type, key size, key, and value size */
+	const size_t val_size_offset = 32 + sizeof(size_t) + sizeof(int) + sizeof(size_t) + 3;
+
+	b = bundle_create();
+	bundle_add(b, "k1", "v1");
+
+	/* Value size runs out of data, with a valid checksum */
+	r = _test_forge_size(b, val_size_offset, 100000);
+	assert(NULL == bundle_decode(r, strlen((char *)r)) && EBADMSG == errno);
+
+	/* Bundle is not changed by broken data */
+	b2 = bundle_create();
+	bundle_add(b2, "x", "y");
+	assert(-1 == bundle_decode_into(b2, r, strlen((char *)r)) && EBADMSG == errno);
+	assert(1 == bundle_get_count(b2) && 0 == strcmp("y", bundle_get_val(b2, "x")));
+	g_free(r);
+
+	/* Child is checked when it is decoded. Key "c" is one byte shorter than "k1". */
+	child = b;
+	b = bundle_create();
+	bundle_add_bundle(b, "c", child);
+	bundle_free(child);
+	r = _test_forge_size(b, val_size_offset - 1 + sizeof(size_t) + val_size_offset - 32, 100000);
+	bundle_free(b);
+	b = bundle_decode(r, strlen((char *)r));
+	assert(b);
+	assert(-1 == bundle_get_bundle(b, "c", &child) && EBADMSG == errno);
+	g_free(r);
+
+	bundle_free(b);
+	bundle_free(b2);
+}
+
+void test_bundle_decode_binary_broken(void)
+{
+	bundle *b;
+	unsigned char *data;
+	size_t len, forged;
+	const char *sa[] = { "a", "b" };
+	/* Offset of the first element size: checksum, total, type, key size, key, and array length */
+	const size_t elem_size_offset = 32 + sizeof(size_t) + sizeof(int) + sizeof(size_t) + 3 + sizeof(unsigned int);
+
+	b = bundle_create();
+	bundle_add_str_array(b, "k2", sa, 2);
+	assert(0 == bundle_encode_binary(b, &data, &len));
+	bundle_free(b);
+
+	/* Truncated payload, with a valid checksum */
+	g_free(_test_seal_binary(data, len - 1));
+	assert(NULL == bundle_decode_binary(data, len - 1) && EBADMSG == errno);
+
+	/* Oversized element size, with a valid checksum */
+	forged = 100000;
+	memcpy(data + elem_size_offset, &forged, sizeof(size_t));
+	g_free(_test_seal_binary(data, len));
+	assert(NULL == bundle_decode_binary(data, len) && EBADMSG == errno);
+
+	free(data);
+}
+
+void test_bundle_raw_get_str(void)
+{
+	bundle *b;
+	unsigned char *data;
+	size_t len, size;
+	const char *str;
+	const char *sa[] = { "a", "b" };
+
+	b = bundle_create();
+	bundle_add_str_array(b, "k1", sa, 2);
+	bundle_add(b, "k2", "v2");
+	bundle_add_int64(b, "k3", 3);
+	bundle_add(b, "__OPERATION__", "launch");
+	assert(0 == bundle_encode_binary(b, &data, &len));
+	bundle_free(b);
+
+	assert(0 == bundle_raw_get_str(data, len, "__OPERATION__", &str, &size));
+	assert(6 == size && 0 == strcmp("launch", str));
+	assert(str > (char *)data && str < (char *)data + len);
+	assert(0 == bundle_raw_get_str(data, len, "k2", &str, NULL));
+	assert(0 == strcmp("v2", str));
+
+	assert(-1 == bundle_raw_get_str(data, len, "k4", &str, NULL) && ENOKEY == errno);
+	assert(-1 == bundle_raw_get_str(data, len, "k3", &str, NULL) && ENOTSUP == errno);
+	assert(-1 == bundle_raw_get_str(data, 10, "k2", &str, NULL) && EINVAL == errno);
+
+	/* Truncated data */
+	assert(-1 == bundle_raw_get_str(data, len - 3, "__OPERATION__", &str, NULL) && EBADMSG == errno);
+
+	free(data);
+}
+
+void test_bundle_raw_append(void)
+{
+	bundle *b;
+	unsigned char *data;
+	size_t len;
+	const char *str;
+	const char *sa[] = { "a", "b" };
+
+	b = bundle_create();
+	bundle_add(b, "k1", "v1");
+	bundle_add_str_array(b, "k2", sa, 2);
+	assert(0 == bundle_encode_binary(b, &data, &len));
+	bundle_free(b);
+
+	assert(0 == bundle_raw_append(&data, &len, "k3", "v3", BUNDLE_RAW_APPEND_CHECK_DUP));
+	assert(0 == bundle_raw_append(&data, &len, "k4", "", 0));
+	assert(-1 == bundle_raw_append(&data, &len, "k1", "x", BUNDLE_RAW_APPEND_CHECK_DUP) && EPERM == errno);
+	assert(-1 == bundle_raw_append(&data, &len, "", "x", 0) && EKEYREJECTED == errno);
+	assert(-1 == bundle_raw_append(&data, &len, "k5", NULL, 0) && EINVAL == errno);
+
+	assert(0 == bundle_raw_get_str(data, len, "k3", &str, NULL));
+	assert(0 == strcmp("v3", str));
+
+	/* Checksum is valid */
+	b = bundle_decode_binary(data, len);
+	assert(b);
+	assert(4 == bundle_get_count(b));
+	assert(0 == strcmp("v1", bundle_get_val(b, "k1")));
+	assert(0 == strcmp("v3", bundle_get_val(b, "k3")));
+	assert(0 == strcmp("", bundle_get_val(b, "k4")));
+	bundle_free(b);
+
+	/* Broken data is not sealed again */
+	data[len - 1] ^= 1;	/* Terminator of the value of k4 */
+	assert(NULL == bundle_decode_binary(data, len) && EBADMSG == errno);
+	assert(-1 == bundle_raw_append(&data, &len, "k5", "v5", 0) && EBADMSG == errno);
+	assert(NULL == bundle_decode_binary(data, len));
+
+	free(data);
+}
+
 int main(int argc, char **argv)
 {
 	test_bundle_create();
@@ -282,6 +1770,34 @@ int main(int argc, char **argv)
 	test_bundle_2byte_chars();
 	test_bundle_dup();
 	test_bundle_convert_argv();
+	test_bundle_diff_patch();
+	test_bundle_set();
+	test_bundle_add_get_many();
+	test_bundle_merge();
+	test_bundle_capacity_clear();
+	test_bundle_primitive_types();
+	test_bundle_nested();
+	test_bundle_nested_argv();
+	test_bundle_byte();
+	test_bundle_take();
+	test_bundle_key_intern();
+	test_bundle_key_handle();
+	test_bundle_iter();
+	test_bundle_prefix();
+	test_bundle_project();
+	test_bundle_encoded_size();
+	test_bundle_encode_shared();
+	test_bundle_incremental_encode();
+	test_bundle_canonical();
+	test_bundle_decode_cached();
+	test_bundle_encode_iov();
+	test_bundle_send_recv();
+	test_bundle_decode_into();
+	test_bundle_decode_keys();
+	test_bundle_decode_broken();
+	test_bundle_decode_binary_broken();
+	test_bundle_raw_get_str();
+	test_bundle_raw_append();
 
 	return 0;
 }
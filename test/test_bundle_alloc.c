@@ -0,0 +1,220 @@
+/*
+ * Copyright (c) 2011 Samsung Electronics Co., Ltd. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+
+/*
+ * Tests of allocation reuse. Separated from test_bundle, because malloc and
+ * friends are replaced by counting wrappers in this program.
+ */
+
+#define _GNU_SOURCE		/* RTLD_NEXT */
+
+#include <assert.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <dlfcn.h>
+#include "bundle.h"
+
+/* Memory given out while the real allocator is looked up. dlsym() may allocate. */
+static char _boot_heap[4096];
+static size_t _boot_used;
+
+static void *(*_real_malloc)(size_t size);
+static void *(*_real_calloc)(size_t n, size_t size);
+static void *(*_real_realloc)(void *ptr, size_t size);
+static void (*_real_free)(void *ptr);
+static int _in_init;
+
+static int _n_allocs;
+static int _n_live;	/* Allocated, and not freed yet */
+static int _n_fail_at;	/* If not 0, this allocation and later ones fail */
+
+static void
+_init_allocator(void)
+{
+	_in_init = 1;
+	_real_malloc = dlsym(RTLD_NEXT, "malloc");
+	_real_calloc = dlsym(RTLD_NEXT, "calloc");
+	_real_realloc = dlsym(RTLD_NEXT, "realloc");
+	_real_free = dlsym(RTLD_NEXT, "free");
+	_in_init = 0;
+	assert(_real_malloc && _real_calloc && _real_realloc && _real_free);
+}
+
+static void *
+_boot_alloc(size_t size)
+{
+	void *p = _boot_heap + _boot_used;
+
+	size = (size + 15) & ~(size_t)15;
+	if(size > sizeof(_boot_heap) - _boot_used) return NULL;
+	_boot_used += size;
+	memset(p, 0, size);
+	return p;
+}
+
+static int
+_is_boot(void *ptr)
+{
+	return (char *)ptr >= _boot_heap && (char *)ptr < _boot_heap + sizeof(_boot_heap);
+}
+
+void *
+malloc(size_t size)
+{
+	if(_in_init) return _boot_alloc(size);
+	if(!_real_malloc) _init_allocator();
+	_n_allocs++;
+	if(_n_fail_at && _n_allocs >= _n_fail_at) return NULL;
+	_n_live++;
+	return _real_malloc(size);
+}
+
+void *
+calloc(size_t n, size_t size)
+{
+	if(_in_init) return n && size > sizeof(_boot_heap) / n ? NULL : _boot_alloc(n * size);
+	if(!_real_calloc) _init_allocator();
+	_n_allocs++;
+	if(_n_fail_at && _n_allocs >= _n_fail_at) return NULL;
+	_n_live++;
+	return _real_calloc(n, size);
+}
+
+void *
+realloc(void *ptr, size_t size)
+{
+	if(_in_init || _is_boot(ptr)) return NULL;	/* Not expected */
+	if(!_real_realloc) _init_allocator();
+	_n_allocs++;
+	if(_n_fail_at && _n_allocs >= _n_fail_at) return NULL;
+	if(!ptr) _n_live++;
+	return _real_realloc(ptr, size);
+}
+
+void
+free(void *ptr)
+{
+	if(_is_boot(ptr)) return;
+	if(!_real_free) _init_allocator();
+	if(ptr) _n_live--;
+	_real_free(ptr);
+}
+
+/* Allocations of a bundle_decode_into() round, after rounds with the same keys */
+static int _test_decode_into_allocs(int n_keys)
+{
+	bundle *src, *b;
+	bundle_raw *r;
+	int len, i, n;
+	char key[16];
+
+	src = bundle_create();
+	for(i = 0; i < n_keys; i++) {
+		snprintf(key, sizeof(key), "key%d", i);
+		bundle_add(src, key, "value");
+	}
+	bundle_encode(src, &r, &len);
+	bundle_free(src);	/* Keys are kept only by b */
+
+	b = bundle_create_with_capacity(n_keys);
+	assert(0 == bundle_decode_into(b, r, len));
+	assert(0 == bundle_decode_into(b, r, len));
+
+	n = _n_allocs;
+	assert(0 == bundle_decode_into(b, r, len));
+	n = _n_allocs - n;
+	assert(n_keys == bundle_get_count(b));
+
+	bundle_free(b);
+	free(r);
+	return n;
+}
+
+void test_bundle_decode_into_allocs(void)
+{
+	/* Nodes, keys and value buffers are all reused. Only decoding buffers are allocated. */
+	int n20 = _test_decode_into_allocs(20);
+	assert(n20 < 20);
+	assert(n20 == _test_decode_into_allocs(40));
+}
+
+void test_bundle_clear_frees(void)
+{
+	bundle *b;
+	char key[16];
+	int i, n;
+
+	/* Bundle without reserved capacity keeps nothing after deletes */
+	b = bundle_create();
+	n = _n_live;
+	for(i = 0; i < 10; i++) {
+		snprintf(key, sizeof(key), "key%d", i);
+		bundle_add(b, key, "value");
+	}
+	assert(0 == bundle_clear(b));
+	assert(n == _n_live);
+	bundle_free(b);
+}
+
+/* Fail each allocation of adding in turn. Nothing is leaked or freed twice. */
+void test_bundle_add_nomem(void)
+{
+	const char *arr[] = { "aaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaa", "b" };
+	bundle *src, *b;
+	bundle_raw *r;
+	int len, i, ret, n_live;
+
+	src = bundle_create();
+	bundle_add(src, "key", "value");
+	bundle_add_str_array(src, "arr", arr, 2);
+	bundle_encode(src, &r, &len);
+	bundle_free(src);
+
+	for(i = 1; ; i++) {
+		/* Pooled kvs are given to failing constructors */
+		n_live = _n_live;
+		b = bundle_create_with_capacity(4);
+		assert(0 == bundle_decode_into(b, r, len));
+		assert(0 == bundle_clear(b));
+
+		_n_fail_at = _n_allocs + i;
+		ret = bundle_add(b, "key2", arr[0]);
+		if(0 == ret) ret = bundle_add_str_array(b, "arr2", arr, 2);
+		_n_fail_at = 0;
+
+		bundle_free(b);
+		assert(n_live == _n_live);
+		if(0 == ret) break;	/* All allocations are done */
+	}
+	assert(i > 1);
+	free(r);
+}
+
+int main(int argc, char **argv)
+{
+#ifdef __SANITIZE_ADDRESS__
+	/* AddressSanitizer has its own malloc, which can not be wrapped */
+	printf("Allocation tests are skipped with AddressSanitizer\n");
+	return 0;
+#endif
+	test_bundle_decode_into_allocs();
+	test_bundle_clear_frees();
+	test_bundle_add_nomem();
+
+	return 0;
+}